@@ -0,0 +1,186 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Minimal stand-ins for the parts of the kernel which the gengc sources refer to, so
+ * that they can be compiled into an ordinary host process.  Paging is simulated over the
+ * arena the heap lives in: Map zeroes the pages and Unmap poisons them, so that use of a
+ * released large object shows up in the replay */
+
+using System;
+using System.Collections.Generic;
+using System.Runtime.InteropServices;
+
+namespace libsupcs
+{
+    static class OtherOperations
+    {
+        public static int EnterUninterruptibleSection() { return 0; }
+        public static void ExitUninterruptibleSection(int state) { }
+        public static void Halt() { throw new Exception("Halt"); }
+        public static void AsmBreakpoint() { throw new Exception("AsmBreakpoint"); }
+    }
+
+    static class Monitor
+    {
+        public static void Enter(object o) { System.Threading.Monitor.Enter(o); }
+        public static void Exit(object o) { System.Threading.Monitor.Exit(o); }
+    }
+
+    static unsafe class MemoryOperations
+    {
+        public static void MemSet(void* p, byte v, int len) { NativeMemory.Fill(p, (nuint)len, v); }
+    }
+
+    class ProfileAttribute : Attribute
+    {
+        public ProfileAttribute(bool profile) { }
+    }
+}
+
+namespace tysos
+{
+    class Program
+    {
+        internal static Arch arch = new Arch();
+    }
+
+    class Arch
+    {
+        [ThreadStatic] static Cpu cur;
+        internal Cpu CurrentCpu { get { return cur; } set { cur = value; } }
+        internal IDebugOutput DebugOutput = new NullOutput();
+        internal List<Cpu> Processors = new List<Cpu>();
+        internal VirtMem VirtMem = new VirtMem();
+        internal PhysMem PhysMem = new PhysMem();
+
+        /* 100 ns ticks, as the kernel's */
+        internal long GetNow()
+        {
+            return System.Diagnostics.Stopwatch.GetTimestamp() * 10000000 /
+                System.Diagnostics.Stopwatch.Frequency;
+        }
+    }
+
+    class NullOutput : IDebugOutput
+    {
+        public void Write(string s) { }
+        public void Write(char ch) { }
+        public void Flush() { }
+    }
+
+    unsafe class VirtMem
+    {
+        public const uint FLAG_allocate = 0x1;
+        public const uint FLAG_writeable = 0x2;
+
+        HashSet<nuint> mapped = new HashSet<nuint>();
+        internal long PagesMapped { get { lock (mapped) return mapped.Count; } }
+
+        public object Map(nuint paddr, nuint len, nuint vaddr, uint flags)
+        {
+            lock (mapped)
+            {
+                for (nuint x = 0; x < len; x += 0x1000)
+                {
+                    if (!mapped.Add(vaddr + x))
+                        throw new Exception("VirtMem.Map: " + (vaddr + x).ToString("X") + " is already mapped");
+                    NativeMemory.Clear((void*)(vaddr + x), 0x1000);
+                }
+            }
+            return null;
+        }
+
+        public nuint Unmap(nuint vaddr)
+        {
+            lock (mapped)
+            {
+                if (!mapped.Remove(vaddr))
+                    return 0;
+                NativeMemory.Fill((void*)vaddr, 0x1000, 0xcc);
+            }
+            return vaddr;
+        }
+
+        internal void Reset()
+        {
+            lock (mapped)
+                mapped.Clear();
+        }
+    }
+
+    class PhysMem
+    {
+        public void Release(nuint paddr, nuint len) { }
+        public void ReleaseMapped(nuint paddr) { }
+    }
+
+    unsafe class Cpu
+    {
+        internal void* gc_alloc_buffer = null;
+        internal int Id;
+        internal Scheduler CurrentScheduler = new Scheduler();
+    }
+
+    /* gc_worker threads become real threads */
+    class Scheduler
+    {
+        public void Reschedule(Thread t)
+        {
+            var th = new System.Threading.Thread(() =>
+            {
+                Program.arch.CurrentCpu = t.affinity;
+                t.d.DynamicInvoke();
+            });
+            th.IsBackground = true;
+            th.Start();
+        }
+    }
+
+    class Thread
+    {
+        internal int priority;
+        internal Cpu affinity;
+        internal Delegate d;
+
+        internal static Thread Create(string name, Delegate e, object[] p)
+        {
+            return new Thread { d = e };
+        }
+    }
+
+    class Event
+    {
+        System.Threading.ManualResetEventSlim e = new System.Threading.ManualResetEventSlim(false);
+        public void Set() { e.Set(); }
+        public void Reset() { e.Reset(); }
+        internal void Wait() { e.Wait(); }
+    }
+
+    static class Syscalls
+    {
+        internal static class SchedulerFunctions
+        {
+            public static void Block(Event e) { e.Wait(); }
+            public static void Sleep(long ns) { System.Threading.Thread.Sleep((int)(ns / 1000000)); }
+        }
+    }
+}
@@ -0,0 +1,219 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* GcTestHost: replays allocation traces against gengc on the host, reporting allocation
+ * throughput, collection pauses, heap fragmentation and peak memory use.
+ * 
+ * Usage: GcTestHost [options] [workload...]
+ * 
+ *  --trace file        replay the gctrace lines in a debug output log (may be repeated)
+ *  --heap n            heap size in MiB (default 1024)
+ *  --minor             run minor collections
+ *  --incremental us    run incremental full collections with this pause budget
+ *  --workers n         start n mark workers (needs a single trace or workload)
+ *  --growth n          HeapGrowthPercent (default 100)
+ *  --window n          number of recent allocations kept as roots (default 256)
+ *  --step-ops n        trace operations between incremental steps (default 1000)
+ *  --background-sweep  sweep lazily between operations, as the gc_sweep thread would
+ *  --scale f           size of the synthetic workloads (default 1.0)
+ *  --seed n            random seed (default 1)
+ *  --verify            check that no reachable object has been freed after each collection
+ * 
+ * Workloads are strings, trees, buffers and mixed (default all, unless traces are given).
+ * Traces can be recorded by booting with the gctrace option.  Fragmentation is the part
+ * of the heap's footprint not taken up by reachable objects, sampled after each
+ * collection.  The exit code is non-zero if any allocation failed or verification found
+ * a freed object, so it can be used as a regression test.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+
+namespace GcTestHost
+{
+    class Program
+    {
+        static int Main(string[] args)
+        {
+            ulong heap = 1024;
+            int workers = 0;
+            int window = 256;
+            int step_ops = 1000;
+            bool background_sweep = false;
+            bool verify = false;
+            double scale = 1.0;
+            int seed = 1;
+            List<string> traces = new List<string>();
+            List<string> workloads = new List<string>();
+
+            for (int i = 0; i < args.Length; i++)
+            {
+                switch (args[i])
+                {
+                    case "--trace":
+                        traces.Add(args[++i]);
+                        break;
+                    case "--heap":
+                        heap = ulong.Parse(args[++i]);
+                        break;
+                    case "--minor":
+                        tysos.gc.gengc.MinorCollections = true;
+                        break;
+                    case "--incremental":
+                        tysos.gc.gengc.IncrementalCollections = true;
+                        tysos.gc.gengc.IncrementalPauseBudget = long.Parse(args[++i]) * 1000;
+                        break;
+                    case "--workers":
+                        workers = int.Parse(args[++i]);
+                        break;
+                    case "--growth":
+                        tysos.gc.gengc.HeapGrowthPercent = int.Parse(args[++i]);
+                        break;
+                    case "--window":
+                        window = int.Parse(args[++i]);
+                        break;
+                    case "--step-ops":
+                        step_ops = int.Parse(args[++i]);
+                        break;
+                    case "--background-sweep":
+                        background_sweep = true;
+                        break;
+                    case "--scale":
+                        scale = double.Parse(args[++i], CultureInfo.InvariantCulture);
+                        break;
+                    case "--verify":
+                        verify = true;
+                        break;
+                    case "--seed":
+                        seed = int.Parse(args[++i]);
+                        break;
+                    default:
+                        if (args[i].StartsWith("--"))
+                        {
+                            Console.WriteLine("unknown option " + args[i]);
+                            return 2;
+                        }
+                        workloads.Add(args[i]);
+                        break;
+                }
+            }
+            if (workloads.Count == 0 && traces.Count == 0)
+                workloads.AddRange(Workloads.Names);
+
+            /* The gc_worker threads stay attached to the first heap they see */
+            if (workers > 0 && workloads.Count + traces.Count > 1)
+            {
+                Console.WriteLine("--workers needs a single trace or workload");
+                return 2;
+            }
+
+            Console.WriteLine(string.Format("{0,-12} {1,9} {2,8} {3,8} {4,8} {5,6} {6,28} {7,13} {8,8} {9,6}",
+                "trace", "allocs", "MiB", "Mallocs/s", "MiB/s", "colls", "pause p50/p90/p99/max ms",
+                "frag avg/end", "peak MiB", "dead"));
+
+            bool failed = false;
+            var list = new List<Func<Trace>>();
+            foreach (var w in workloads)
+            {
+                var name = w;
+                list.Add(() => Workloads.Build(name, seed, scale));
+            }
+            foreach (var t in traces)
+            {
+                var path = t;
+                list.Add(() => Trace.Load(path));
+            }
+
+            bool workers_started = false;
+            foreach (var build in list)
+            {
+                var trace = build();
+                if (trace == null)
+                {
+                    Console.WriteLine("unknown workload");
+                    return 2;
+                }
+
+                var r = new Replayer();
+                r.HeapSize = heap << 20;
+                r.Window = window;
+                r.StepOps = step_ops;
+                r.BackgroundSweep = background_sweep;
+                r.Verify = verify;
+                r.OnHeapCreated = () =>
+                {
+                    if (workers > 0 && !workers_started)
+                    {
+                        for (int i = 0; i < workers; i++)
+                            tysos.Program.arch.Processors.Add(new tysos.Cpu { Id = i + 1 });
+                        tysos.gc.gengc.StartMarkWorkers();
+                        workers_started = true;
+                    }
+                };
+
+                bool ok = r.Run(trace);
+                Report(trace.Name, r);
+                if (!ok)
+                {
+                    Console.WriteLine("  " + trace.Name + ": " + r.Error);
+                    failed = true;
+                }
+                r.Free();
+            }
+
+            return failed ? 1 : 0;
+        }
+
+        static void Report(string name, Replayer r)
+        {
+            double alloc_s = r.AllocTicks / (double)System.Diagnostics.Stopwatch.Frequency;
+            double mib = r.AllocBytes / 1048576.0;
+            r.Pauses.Sort();
+
+            Console.WriteLine(string.Format(CultureInfo.InvariantCulture,
+                "{0,-12} {1,9} {2,8:F1} {3,8:F2} {4,8:F0} {5,6} {6,28} {7,13} {8,8:F1} {9,6}",
+                name, r.Allocs, mib,
+                alloc_s > 0 ? r.Allocs / alloc_s / 1e6 : 0.0,
+                alloc_s > 0 ? mib / alloc_s : 0.0,
+                r.Collections,
+                string.Format(CultureInfo.InvariantCulture, "{0:F2}/{1:F2}/{2:F2}/{3:F2}",
+                    Percentile(r.Pauses, 0.5), Percentile(r.Pauses, 0.9),
+                    Percentile(r.Pauses, 0.99), Percentile(r.Pauses, 1.0)),
+                string.Format(CultureInfo.InvariantCulture, "{0:F2}/{1:F2}",
+                    r.FragmentationSamples == 0 ? 0.0 : r.FragmentationSum / r.FragmentationSamples,
+                    r.FinalFragmentation),
+                r.PeakFootprint / 1048576.0,
+                r.DeadStores));
+        }
+
+        static double Percentile(List<double> sorted, double p)
+        {
+            if (sorted.Count == 0)
+                return 0.0;
+            int idx = (int)Math.Ceiling(p * sorted.Count) - 1;
+            if (idx < 0)
+                idx = 0;
+            return sorted[idx];
+        }
+    }
+}
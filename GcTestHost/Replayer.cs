@@ -0,0 +1,381 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Replays a trace against gengc
+ * 
+ * Each traced object is allocated from a gengc heap over an arena of host memory, and each
+ * store is repeated at the same offset within the new copy of the object.  Stores to slots
+ * outside any object go to a table of root slots.  As the trace does not record the stack,
+ * the last Window objects allocated are also kept as roots.
+ * 
+ * Collections are run as the kernel's collection threads would: whenever the heap says
+ * one is due, with the steps of an incremental collection spread StepOps trace operations
+ * apart.
+ * 
+ * The replayer keeps its own copy of the object graph.  Once a collection completes, any
+ * object which is unreachable in it may have been freed, so it is marked dead.  Later
+ * stores to or of dead objects (which a recorded trace may contain, as the stack is
+ * missing) are counted and otherwise ignored rather than corrupting the heap.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+using tysos.gc;
+
+namespace GcTestHost
+{
+    unsafe class Replayer
+    {
+        class Obj
+        {
+            public ulong Orig;
+            public ulong Size;
+            public byte* Ptr;
+            public bool NoScan;
+            public Dictionary<int, Obj> Refs;
+            public int Mark;
+            public int DeadAt = -1;     // collection after which it was found unreachable
+        }
+
+        public ulong HeapSize = 1024UL << 20;
+        public int Window = 256;
+        public int RootSlots = 65536;
+        public int StepOps = 1000;
+        public bool BackgroundSweep = false;
+        public bool Verify = false;
+        public Action OnHeapCreated;
+
+        /* Results */
+        public long Allocs, AllocBytes, AllocTicks;
+        public List<double> Pauses = new List<double>();       // ms
+        public int Collections;
+        public long PeakFootprint;
+        public double FragmentationSum, FinalFragmentation;
+        public int FragmentationSamples;
+        public long DeadStores;
+        public string Error;
+
+        gengc g;
+        byte* arena;
+        byte* heap_start;
+        int collection_gen = 0;
+
+        Dictionary<ulong, List<Obj>> pages = new Dictionary<ulong, List<Obj>>();
+        Obj[] window_objs;
+        byte** window_roots;
+        int window_pos = 0;
+        Dictionary<ulong, int> root_index = new Dictionary<ulong, int>();
+        Obj[] root_objs;
+        byte** root_mem;
+
+        public bool Run(Trace t)
+        {
+            /* Fresh anonymous memory is already zero, so this does not touch the whole arena */
+            arena = (byte*)NativeMemory.AllocZeroed((nuint)(HeapSize + 0x1000));
+            heap_start = (byte*)(((ulong)arena + 0xfff) & ~0xfffUL);
+            tysos.Program.arch.VirtMem.Reset();
+            tysos.Program.arch.CurrentCpu = new tysos.Cpu { Id = 0 };
+
+            g = new gengc();
+            gengc.heap = g;
+            g.Init(heap_start, heap_start + HeapSize);
+
+            window_objs = new Obj[Window];
+            window_roots = (byte**)NativeMemory.AllocZeroed((nuint)(Window * sizeof(byte*)));
+            g.AddRoots((byte*)window_roots, (byte*)(window_roots + Window));
+            root_objs = new Obj[RootSlots];
+            root_mem = (byte**)NativeMemory.AllocZeroed((nuint)(RootSlots * sizeof(byte*)));
+            g.AddRoots((byte*)root_mem, (byte*)(root_mem + RootSlots));
+            if (OnHeapCreated != null)
+                OnHeapCreated();
+
+            try
+            {
+                for (int i = 0; i < t.Ops.Count; i++)
+                {
+                    var op = t.Ops[i];
+                    if (op.Type == TraceOpType.Alloc)
+                    {
+                        if (!Alloc(op.Addr, op.Value, op.NoScan))
+                        {
+                            Error = "allocation of " + op.Value.ToString() + " bytes failed at operation " + i.ToString();
+                            return false;
+                        }
+                    }
+                    else
+                        Store(op.Addr, op.Value);
+
+                    Poll(i);
+                }
+
+                /* Let any collection which is running finish, so that it is reported */
+                while (g.HostMarking)
+                    TimedStep();
+            }
+            catch (Exception e)
+            {
+                Error = e.Message;
+                return false;
+            }
+
+            return true;
+        }
+
+        /** <summary>Release the arena.  The gengc instance must not be used afterwards</summary> */
+        public void Free()
+        {
+            NativeMemory.Free(arena);
+            NativeMemory.Free(window_roots);
+            NativeMemory.Free(root_mem);
+        }
+
+        bool Alloc(ulong addr, ulong size, bool noscan)
+        {
+            long t0 = Stopwatch.GetTimestamp();
+            byte* p = (byte*)g.Alloc((int)size, noscan);
+            if (p == null)
+                return false;
+            NativeMemory.Clear(p, (nuint)size);        // as gc.Alloc does
+            AllocTicks += Stopwatch.GetTimestamp() - t0;
+
+            var o = new Obj { Orig = addr, Size = size, Ptr = p, NoScan = noscan };
+
+            /* The traced system has reused the address, so anything that was there is dead */
+            ulong first = addr >> 12;
+            ulong last = (addr + (size == 0 ? 1 : size) - 1) >> 12;
+            for (ulong pg = first; pg <= last; pg++)
+            {
+                List<Obj> l;
+                if (!pages.TryGetValue(pg, out l))
+                {
+                    l = new List<Obj>();
+                    pages[pg] = l;
+                }
+                l.RemoveAll(x => x.Orig < addr + size && addr < x.Orig + x.Size);
+                l.Add(o);
+            }
+
+            int w = window_pos++ % Window;
+            window_objs[w] = o;
+            window_roots[w] = p;
+
+            Allocs++;
+            AllocBytes += (long)size;
+            long fp = Footprint();
+            if (fp > PeakFootprint)
+                PeakFootprint = fp;
+            return true;
+        }
+
+        Obj Find(ulong addr)
+        {
+            List<Obj> l;
+            if (!pages.TryGetValue(addr >> 12, out l))
+                return null;
+            foreach (var o in l)
+            {
+                if (addr >= o.Orig && addr < o.Orig + o.Size)
+                    return o;
+            }
+            return null;
+        }
+
+        void Store(ulong slot, ulong value)
+        {
+            Obj target = null;
+            if (value != 0)
+            {
+                target = Find(value);
+                if (target != null && target.DeadAt >= 0)
+                {
+                    DeadStores++;
+                    target = null;
+                }
+            }
+            byte* new_value = target == null ? null : target.Ptr + (value - target.Orig);
+
+            Obj holder = Find(slot);
+            if (holder != null)
+            {
+                ulong offset = slot - holder.Orig;
+                if (holder.DeadAt >= 0 || offset + (ulong)sizeof(byte*) > holder.Size)
+                {
+                    DeadStores++;
+                    return;
+                }
+
+                byte** p = (byte**)(holder.Ptr + offset);
+                *p = new_value;
+                g.WriteBarrier(p);
+
+                /* The collector does not look inside noscan objects, so nor do we */
+                if (target == null || holder.NoScan)
+                {
+                    if (holder.Refs != null)
+                        holder.Refs.Remove((int)offset);
+                }
+                else
+                {
+                    if (holder.Refs == null)
+                        holder.Refs = new Dictionary<int, Obj>();
+                    holder.Refs[(int)offset] = target;
+                }
+            }
+            else
+            {
+                int idx;
+                if (!root_index.TryGetValue(slot, out idx))
+                {
+                    /* Once the table is full, slots share entries */
+                    idx = root_index.Count < RootSlots ? root_index.Count : (int)(slot / 8 % (ulong)RootSlots);
+                    root_index[slot] = idx;
+                }
+                root_mem[idx] = new_value;
+                root_objs[idx] = target;
+            }
+        }
+
+        void Poll(int i)
+        {
+            if (g.HostMarking)
+            {
+                if (i % StepOps == 0)
+                    TimedStep();
+            }
+            else if (g.HostCollectionDue)
+            {
+                long t0 = Stopwatch.GetTimestamp();
+                g.Collect();
+                Pauses.Add(Ms(Stopwatch.GetTimestamp() - t0));
+                Collections++;
+                if (!g.HostMarking)
+                    CollectionFinished();
+            }
+
+            /* As the gc_sweep thread would when the system is idle */
+            if (BackgroundSweep && i % 64 == 0)
+                g.HostSweepStep();
+        }
+
+        void TimedStep()
+        {
+            long t0 = Stopwatch.GetTimestamp();
+            bool done = g.HostStep();
+            Pauses.Add(Ms(Stopwatch.GetTimestamp() - t0));
+            if (done)
+                CollectionFinished();
+        }
+
+        /** <summary>Find which objects the collection may have freed, and sample
+         * fragmentation</summary> */
+        void CollectionFinished()
+        {
+            collection_gen++;
+
+            long live = 0;
+            var stack = new Stack<Obj>();
+            foreach (var o in window_objs)
+                if (o != null)
+                    stack.Push(o);
+            foreach (var o in root_objs)
+                if (o != null)
+                    stack.Push(o);
+            while (stack.Count > 0)
+            {
+                var o = stack.Pop();
+                if (o.Mark == collection_gen || o.DeadAt >= 0)
+                    continue;
+                o.Mark = collection_gen;
+                live += (long)o.Size;
+
+                /* Reachable objects must not have been freed */
+                if (Verify)
+                {
+                    int colour = g.HostColour(o.Ptr);
+                    if (colour != 1 && colour != 2)
+                        throw new Exception("reachable object at " + ((ulong)o.Ptr).ToString("X") +
+                            " has colour " + colour.ToString() + " after collection " + collection_gen.ToString());
+                }
+                if (o.Refs != null)
+                    foreach (var c in o.Refs.Values)
+                        stack.Push(c);
+            }
+
+            /* Dead objects are remembered for one more collection to catch stray stores,
+             * then forgotten */
+            var empty = new List<ulong>();
+            foreach (var kvp in pages)
+            {
+                var l = kvp.Value;
+                foreach (var o in l)
+                {
+                    if (o.Mark != collection_gen && o.DeadAt < 0)
+                    {
+                        o.DeadAt = collection_gen;
+                        o.Refs = null;
+                    }
+                }
+                l.RemoveAll(x => x.DeadAt >= 0 && x.DeadAt < collection_gen);
+                if (l.Count == 0)
+                    empty.Add(kvp.Key);
+            }
+            foreach (var pg in empty)
+                pages.Remove(pg);
+
+            long fp = Footprint();
+            if (fp > 0)
+            {
+                FinalFragmentation = 1.0 - (double)live / fp;
+                FragmentationSum += FinalFragmentation;
+                FragmentationSamples++;
+            }
+        }
+
+        /** <summary>Memory used by the heap: chunks carved out so far plus pages mapped for
+         * the large object space</summary> */
+        long Footprint()
+        {
+            return g.HostChunkFootprint + tysos.Program.arch.VirtMem.PagesMapped * 0x1000;
+        }
+
+        static double Ms(long ticks)
+        {
+            return ticks * 1000.0 / Stopwatch.Frequency;
+        }
+    }
+}
+
+namespace tysos.gc
+{
+    /* Access to the heap's internals for the replayer */
+    unsafe partial class gengc
+    {
+        internal bool HostCollectionDue { get { return collection_due(); } }
+        internal bool HostMarking { get { return incremental_marking; } }
+        internal bool HostStep() { return incremental_step(IncrementalPauseBudget); }
+        internal int HostColour(void* obj) { return GetColour(obj); }
+        internal bool HostSweepStep() { return lazy_sweep_step(); }
+        internal long HostChunkFootprint { get { return (byte*)heap_top - (byte*)heap_start; } }
+    }
+}
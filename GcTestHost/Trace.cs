@@ -0,0 +1,103 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Allocation traces
+ * 
+ * A trace is a list of allocations and reference stores, with the addresses they had in
+ * the system they were recorded from.  Traces are either read from a debug output log
+ * containing the lines written by tysos/gc/alloc_trace.cs, or built by one of the
+ * synthetic workloads in Workloads.cs.
+ * 
+ * A store to a slot which is not within any allocated object (e.g. a static field or a
+ * stack slot) is treated as a store to a root.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+
+namespace GcTestHost
+{
+    enum TraceOpType { Alloc, Store };
+
+    struct TraceOp
+    {
+        public TraceOpType Type;
+        public ulong Addr;          // address of the object, or of the slot stored to
+        public ulong Value;         // size of the object, or the reference stored
+        public bool NoScan;
+    }
+
+    class Trace
+    {
+        public string Name;
+        public List<TraceOp> Ops = new List<TraceOp>();
+
+        public Trace(string name)
+        {
+            Name = name;
+        }
+
+        public void Alloc(ulong addr, ulong size, bool noscan)
+        {
+            Ops.Add(new TraceOp { Type = TraceOpType.Alloc, Addr = addr, Value = size, NoScan = noscan });
+        }
+
+        public void Store(ulong slot, ulong value)
+        {
+            Ops.Add(new TraceOp { Type = TraceOpType.Store, Addr = slot, Value = value });
+        }
+
+        /** <summary>Read the gctrace lines from a log.  Anything else in it, including lines
+         * broken up by other output, is ignored</summary> */
+        public static Trace Load(string path)
+        {
+            var t = new Trace(Path.GetFileName(path));
+            int bad = 0;
+
+            foreach (var line in File.ReadLines(path))
+            {
+                int idx = line.IndexOf("gctrace: ");
+                if (idx < 0)
+                    continue;
+
+                var parts = line.Substring(idx + 9).Split(new char[] { ' ' }, StringSplitOptions.RemoveEmptyEntries);
+                ulong a, b;
+                if (parts.Length == 4 && parts[0] == "A" &&
+                    ulong.TryParse(parts[1], NumberStyles.HexNumber, null, out a) &&
+                    ulong.TryParse(parts[2], out b))
+                    t.Alloc(a, b, parts[3] == "1");
+                else if (parts.Length == 3 && parts[0] == "W" &&
+                    ulong.TryParse(parts[1], NumberStyles.HexNumber, null, out a) &&
+                    ulong.TryParse(parts[2], NumberStyles.HexNumber, null, out b))
+                    t.Store(a, b);
+                else
+                    bad++;
+            }
+
+            if (bad != 0)
+                Console.WriteLine(path + ": ignored " + bad.ToString() + " malformed trace lines");
+            return t;
+        }
+    }
+}
@@ -0,0 +1,216 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Synthetic workloads
+ * 
+ *  strings     tiny noscan objects, most of which die at once and a few of which replace
+ *              entries in a long-lived table
+ *  trees       GCBench style: a long-lived tree and array, then many short-lived trees
+ *              of increasing depth built top-down
+ *  buffers     requests with large noscan buffers, a fixed number in flight, and some
+ *              small temporaries each
+ *  mixed       a randomly mutated object graph with a range of object sizes
+ * 
+ * Objects are given addresses in a range which is never reused, and statics (which are
+ * roots) lie below it.
+ */
+
+using System;
+using System.Collections.Generic;
+
+namespace GcTestHost
+{
+    class SyntheticHeap
+    {
+        const ulong statics = 0x1000;
+        ulong next = 0x100000000000UL;
+
+        public Trace Trace;
+
+        public SyntheticHeap(string name)
+        {
+            Trace = new Trace(name);
+        }
+
+        public ulong Alloc(int size, bool noscan)
+        {
+            ulong ret = next;
+            next += ((ulong)size + 15) & ~15UL;
+            Trace.Alloc(ret, (ulong)size, noscan);
+            return ret;
+        }
+
+        public void Store(ulong obj, int offset, ulong value)
+        {
+            Trace.Store(obj + (ulong)offset, value);
+        }
+
+        public void SetStatic(int idx, ulong value)
+        {
+            Trace.Store(statics + (ulong)idx * 8, value);
+        }
+    }
+
+    static class Workloads
+    {
+        public static readonly string[] Names = new string[] { "strings", "trees", "buffers", "mixed" };
+
+        public static Trace Build(string name, int seed, double scale)
+        {
+            var rnd = new Random(seed);
+            var h = new SyntheticHeap(name);
+
+            switch (name)
+            {
+                case "strings":
+                    Strings(h, rnd, (int)(500000 * scale));
+                    break;
+                case "trees":
+                    Trees(h, scale);
+                    break;
+                case "buffers":
+                    Buffers(h, rnd, (int)(10000 * scale));
+                    break;
+                case "mixed":
+                    Mixed(h, rnd, (int)(300000 * scale));
+                    break;
+                default:
+                    return null;
+            }
+            return h.Trace;
+        }
+
+        static void Strings(SyntheticHeap h, Random rnd, int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                ulong s = h.Alloc(rnd.Next(16, 64), true);
+                if (rnd.Next(20) == 0)
+                    h.SetStatic(rnd.Next(4096), s);
+                else if (rnd.Next(8) == 0)
+                {
+                    /* A short-lived object which refers to it */
+                    ulong holder = h.Alloc(32, false);
+                    h.Store(holder, 8, s);
+                }
+            }
+        }
+
+        static void Trees(SyntheticHeap h, double scale)
+        {
+            const int long_lived_depth = 14;
+            const int node_size = 32;           // left at 8, right at 16
+
+            ulong long_lived = h.Alloc(node_size, false);
+            h.SetStatic(0, long_lived);
+            Populate(h, long_lived_depth, long_lived);
+
+            ulong array = h.Alloc(1 << 20, true);
+            h.SetStatic(1, array);
+
+            for (int depth = 4; depth <= long_lived_depth; depth += 2)
+            {
+                int iters = (int)(scale * 2 * (1 << (long_lived_depth - depth)));
+                for (int i = 0; i < iters; i++)
+                {
+                    ulong root = h.Alloc(node_size, false);
+                    h.SetStatic(2, root);
+                    Populate(h, depth, root);
+                }
+                h.SetStatic(2, 0);
+            }
+        }
+
+        static void Populate(SyntheticHeap h, int depth, ulong node)
+        {
+            if (depth <= 0)
+                return;
+            ulong l = h.Alloc(32, false);
+            h.Store(node, 8, l);
+            ulong r = h.Alloc(32, false);
+            h.Store(node, 16, r);
+            Populate(h, depth - 1, l);
+            Populate(h, depth - 1, r);
+        }
+
+        static void Buffers(SyntheticHeap h, Random rnd, int count)
+        {
+            const int in_flight = 32;
+
+            for (int i = 0; i < count; i++)
+            {
+                ulong req = h.Alloc(64, false);
+                ulong buf = h.Alloc(rnd.Next(4096, 128 * 1024), true);
+                h.Store(req, 8, buf);
+                h.SetStatic(i % in_flight, req);
+
+                for (int j = 0; j < 20; j++)
+                {
+                    ulong tmp = h.Alloc(rnd.Next(16, 256), false);
+                    h.Store(tmp, 8, req);
+                }
+            }
+        }
+
+        static void Mixed(SyntheticHeap h, Random rnd, int count)
+        {
+            const int roots = 512;
+            var chains = new List<ulong>[roots];
+            for (int i = 0; i < roots; i++)
+                chains[i] = new List<ulong>();
+
+            for (int i = 0; i < count; i++)
+            {
+                int size;
+                int r = rnd.Next(100);
+                if (r == 0)
+                    size = rnd.Next(16384, 65536);
+                else if (r < 3)
+                    size = rnd.Next(2049, 8192);
+                else
+                    size = rnd.Next(16, 600);
+                bool noscan = rnd.Next(5) == 0;
+                ulong o = h.Alloc(size, noscan);
+                if (noscan)
+                    continue;
+
+                int root = rnd.Next(roots);
+                var chain = chains[root];
+                if (chain.Count > 0 && rnd.Next(3) == 0)
+                {
+                    /* Insert it into the chain, dropping whatever followed */
+                    int pos = rnd.Next(Math.Min(chain.Count, 8));
+                    h.Store(chain[pos], 0, o);
+                    chain.RemoveRange(pos + 1, chain.Count - pos - 1);
+                    chain.Add(o);
+                }
+                else
+                {
+                    /* Start a new chain */
+                    h.SetStatic(root, o);
+                    chain.Clear();
+                    chain.Add(o);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,165 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Minimal stand-ins for the parts of the kernel which the scheduler sources
+ * refer to, so that they can be compiled into an ordinary host process.  Only
+ * the state the scheduler actually uses is reproduced here - in particular
+ * the scheduling fields of Thread must be kept in step with tysos/Process.cs */
+
+using System;
+using System.Collections.Generic;
+using System.Text;
+
+namespace libsupcs
+{
+    static class OtherOperations
+    {
+        public static int EnterUninterruptibleSection() { return 0; }
+        public static void ExitUninterruptibleSection(int state) { }
+    }
+
+    class ProfileAttribute : Attribute
+    {
+        public ProfileAttribute(bool profile) { }
+    }
+}
+
+namespace tysos
+{
+    class Program
+    {
+        internal static Arch arch = new Arch();
+        internal static Dictionary<string, Process> running_processes = new Dictionary<string, Process>();
+    }
+
+    class Arch
+    {
+        internal Cpu CurrentCpu;
+        internal List<Cpu> Processors = new List<Cpu>();
+        internal TaskSwitcher Switcher;
+        internal IDebugOutput DebugOutput = new NullOutput();
+    }
+
+    class NullOutput : IDebugOutput
+    {
+        public void Write(string s) { }
+        public void Write(char ch) { }
+        public void Flush() { }
+    }
+
+    public class Cpu
+    {
+        Scheduler currentScheduler = null;
+
+        internal Thread CurrentThread = null;
+        internal Timer CurrentTimer = null;
+        internal int Id;
+        internal System.Action OnKick = null;
+
+        internal void Kick()
+        {
+            if (OnKick != null)
+                OnKick();
+        }
+
+        internal Scheduler CurrentScheduler
+        {
+            get { return currentScheduler; }
+            set
+            {
+                currentScheduler = value;
+                if (value != null)
+                    value.cpu = this;
+            }
+        }
+    }
+
+    public abstract class TaskSwitcher
+    {
+        public abstract void Switch(Thread next);
+    }
+
+    public class IPCMessage { }
+
+    class IPC
+    {
+        internal IPCMessage PeekMessage() { return null; }
+    }
+
+    public class Process
+    {
+        public string name;
+        internal IPC ipc = null;
+        internal MessageEvent msg_event = null;
+    }
+
+    public class Thread
+    {
+        internal const long DEF_SLICE = 10000000;     // 10 ms
+        internal const int DEF_PRIORITY = 5;
+
+        internal const int LOC_CURRENT = -1;
+        internal const int LOC_SLEEPING = -2;
+        internal const int LOC_BLOCKING = -3;
+        internal const int LOC_RELEASED = -4;
+        internal const int LOC_WAITING = -5;
+        internal const int LOC_DEADLINE = -6;
+        internal const int LOC_THROTTLED = -7;
+
+        internal int location = LOC_RELEASED;
+        internal int priority = DEF_PRIORITY;
+        internal long time_to_run;
+        internal long default_slice = DEF_SLICE;
+
+        internal Scheduler scheduler = null;
+        internal Thread rq_next, rq_prev;
+        internal Cpu affinity = null;
+        internal TimerWheel.Timeout sleep_timeout;
+
+        internal uint donated_mask = 0;
+        internal int[] donated_count = null;
+        internal long donated_slice = 0;
+
+        internal long dl_runtime = 0;
+        internal long dl_period = 0;
+        internal long dl_deadline = 0;
+        internal long dl_bw = 0;
+        internal long dl_abs_deadline = 0;
+        internal long dl_remaining = 0;
+        internal TimerWheel.Timeout dl_timeout;
+        internal Cpu dl_saved_affinity = null;
+
+        internal int EffectivePriority
+        {
+            get
+            {
+                int d = util.HighestSetBit(donated_mask);
+                return (d > priority) ? d : priority;
+            }
+        }
+
+        public Process owning_process = null;
+        internal string name;
+
+        internal List<Event> BlockingOn = new List<Event>();
+    }
+}
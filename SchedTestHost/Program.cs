@@ -0,0 +1,188 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* SchedTestHost: replays synthetic workloads against the kernel scheduler on
+ * the host, reporting schedule latency, timer tick cost and fairness.
+ * 
+ * Usage: SchedTestHost [options] [workload...]
+ * 
+ *  --cpus n        number of simulated cpus (default 4)
+ *  --threads n     number of threads in each workload (default 256)
+ *  --seconds s     simulated time to run each workload for (default 10)
+ *  --step us       simulation step (default 100 us)
+ *  --nohz          run the scheduler in NO_HZ (one-shot timer) mode
+ *  --seed n        random seed (default 1)
+ * 
+ * Workloads are cpubound, pingpong, sleepstorm and mixed (default all).  The
+ * exit code is non-zero if any thread was left waiting indefinitely after
+ * being woken, or any cpu bound thread was starved completely, so it can be
+ * used as a regression test.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Text;
+
+namespace SchedTestHost
+{
+    class Program
+    {
+        static int Main(string[] args)
+        {
+            int cpus = 4;
+            int threads = 256;
+            double seconds = 10.0;
+            long step = 100000;
+            bool nohz = false;
+            int seed = 1;
+            List<string> workloads = new List<string>();
+
+            for (int i = 0; i < args.Length; i++)
+            {
+                switch (args[i])
+                {
+                    case "--cpus":
+                        cpus = int.Parse(args[++i]);
+                        break;
+                    case "--threads":
+                        threads = int.Parse(args[++i]);
+                        break;
+                    case "--seconds":
+                        seconds = double.Parse(args[++i], System.Globalization.CultureInfo.InvariantCulture);
+                        break;
+                    case "--step":
+                        step = long.Parse(args[++i]) * 1000;
+                        break;
+                    case "--nohz":
+                        nohz = true;
+                        break;
+                    case "--seed":
+                        seed = int.Parse(args[++i]);
+                        break;
+                    default:
+                        if (args[i].StartsWith("-"))
+                        {
+                            Console.Error.WriteLine("Unknown option " + args[i]);
+                            return 2;
+                        }
+                        workloads.Add(args[i]);
+                        break;
+                }
+            }
+            if (workloads.Count == 0)
+                workloads.AddRange(Workloads.Names);
+
+            int failures = 0;
+            foreach (string w in workloads)
+            {
+                Simulator sim = new Simulator(cpus, nohz, seed);
+                sim.Step = step;
+                if (!Workloads.Setup(w, sim, threads))
+                {
+                    Console.Error.WriteLine("Unknown workload " + w);
+                    return 2;
+                }
+
+                DateTime start = DateTime.Now;
+                sim.Run((long)(seconds * 1000000000.0));
+                TimeSpan wall = DateTime.Now - start;
+
+                failures += Report(w, sim, cpus, threads, seconds, nohz, wall);
+            }
+
+            return (failures == 0) ? 0 : 1;
+        }
+
+        static int Report(string name, Simulator sim, int cpus, int threads, double seconds, bool nohz, TimeSpan wall)
+        {
+            int failures = 0;
+
+            Console.WriteLine(name + ": " + cpus.ToString() + " cpus, " + threads.ToString() + " threads, " +
+                seconds.ToString("F1") + " s" + (nohz ? ", nohz" : "") + " (" + wall.TotalSeconds.ToString("F1") + " s host time)");
+
+            /* Timer tick cost */
+            double ticks_per_cpu_s = sim.Ticks / seconds / cpus;
+            Console.WriteLine("  ticks:            " + sim.Ticks.ToString() + " (" + ticks_per_cpu_s.ToString("F1") + " per cpu-second)");
+            if (sim.Ticks > 0)
+                Console.WriteLine("  tick cost:        mean " + (sim.TickCost / sim.Ticks).ToString() + " ns, max " + sim.MaxTickCost.ToString() + " ns");
+            if (sim.Picks > 0)
+                Console.WriteLine("  pick cost:        mean " + (sim.PickCost / sim.Picks).ToString() + " ns over " + sim.Picks.ToString() + " picks");
+
+            /* Schedule latency */
+            if (sim.Latencies.Count > 0)
+            {
+                sim.Latencies.Sort();
+                double sum = 0;
+                foreach (long l in sim.Latencies)
+                    sum += l;
+                Console.WriteLine("  latency (us):     mean " + (sum / sim.Latencies.Count / 1000.0).ToString("F1") +
+                    ", p50 " + Percentile(sim.Latencies, 0.50) +
+                    ", p99 " + Percentile(sim.Latencies, 0.99) +
+                    ", max " + Percentile(sim.Latencies, 1.0) +
+                    " over " + sim.Latencies.Count.ToString() + " wake-ups");
+            }
+
+            /* Fairness between cpu bound threads, as Jain's index: 1.0 is perfectly fair */
+            double total = 0, total_sq = 0;
+            int n = 0, starved = 0;
+            foreach (SimThread st in sim.Threads)
+            {
+                if (st.Group != Workloads.GROUP_CPUBOUND)
+                    continue;
+                double x = st.CpuTime;
+                total += x;
+                total_sq += x * x;
+                n++;
+                if (st.CpuTime == 0)
+                    starved++;
+            }
+            if (n > 0 && total_sq > 0)
+                Console.WriteLine("  fairness:         " + (total * total / (n * total_sq)).ToString("F4") + " (Jain's index over " + n.ToString() + " cpu bound threads)");
+            if (starved > 0)
+            {
+                Console.WriteLine("  FAIL: " + starved.ToString() + " cpu bound threads never ran");
+                failures++;
+            }
+
+            long idle = 0;
+            foreach (SimCpu c in sim.Cpus)
+                idle += c.IdleTime;
+            Console.WriteLine("  idle:             " + (100.0 * idle / (seconds * 1000000000.0 * cpus)).ToString("F1") + "%");
+
+            int lost = sim.LostWakeups(2000000000);
+            if (lost > 0)
+            {
+                Console.WriteLine("  FAIL: " + lost.ToString() + " threads woken but not run within 2 s");
+                failures++;
+            }
+
+            Console.WriteLine();
+            return failures;
+        }
+
+        static string Percentile(List<long> sorted, double p)
+        {
+            int idx = (int)(p * (sorted.Count - 1));
+            return (sorted[idx] / 1000.0).ToString("F1");
+        }
+    }
+}
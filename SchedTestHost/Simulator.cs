@@ -0,0 +1,426 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* A discrete time simulation of a multiprocessor running the real tysos
+ * scheduler.
+ * 
+ * Time advances in steps of Step ns.  In each step every simulated cpu charges
+ * the step to its current thread's cpu burst, performing the thread's next
+ * action (block, sleep, yield...) through the same Scheduler calls as the
+ * corresponding system calls when the burst is complete, and then delivers a
+ * timer interrupt if its SimTimer is due.  The SimTimer runs periodically or,
+ * if the scheduler is in NO_HZ mode, in one-shot mode as programmed by the
+ * scheduler.
+ * 
+ * Schedule latency is the time from a thread becoming entitled to run (its
+ * sleep expiring or an event it is waiting on being set) until it is next
+ * switched to.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Text;
+
+using tysos;
+
+namespace SchedTestHost
+{
+    /** <summary>A cpu timer driven by the simulation clock</summary> */
+    class SimTimer : tysos.Timer
+    {
+        Simulator sim;
+        bool one_shot = false;
+        internal long next_fire;        // simulation time of the next interrupt, or -1 if stopped
+        internal long last_fire = 0;
+
+        internal bool kicked = false;   // an interrupt was raised by another cpu
+
+        internal int Reprograms = 0;
+
+        public SimTimer(Simulator s, long period)
+        {
+            sim = s;
+            interval = period;
+            next_fire = period;
+        }
+
+        internal override long Ticks { get { return sim.Now / 100; } }
+
+        internal override bool SupportsOneShot { get { return true; } }
+
+        internal override void SetOneShot(long ns)
+        {
+            one_shot = true;
+            next_fire = (ns < 0) ? -1 : sim.Now + ns;
+            Reprograms++;
+        }
+
+        internal override long OneShotRemaining
+        {
+            get
+            {
+                if (!one_shot || next_fire < 0)
+                    return -1;
+                return next_fire - sim.Now;
+            }
+        }
+
+        /** <summary>Called when the interrupt is delivered.  Returns the time elapsed since
+         * the previous one</summary> */
+        internal long Fire()
+        {
+            long elapsed = sim.Now - last_fire;
+            last_fire = sim.Now;
+            bool due = next_fire >= 0 && sim.Now >= next_fire;
+            kicked = false;
+            if (!due)
+                return elapsed;
+            if (one_shot)
+                next_fire = -1;
+            else
+                next_fire += interval;
+            return elapsed;
+        }
+    }
+
+    class SimSwitcher : TaskSwitcher
+    {
+        Simulator sim;
+
+        public SimSwitcher(Simulator s) { sim = s; }
+
+        public override void Switch(tysos.Thread next)
+        {
+            tysos.Program.arch.CurrentCpu.CurrentThread = next;
+            sim.Dispatched(next);
+        }
+    }
+
+    /** <summary>A simulated thread: a tysos Thread plus the workload it runs</summary> */
+    class SimThread
+    {
+        public tysos.Thread t;
+        public bool Idle = false;
+
+        /** <summary>Remaining cpu time (ns) in the current burst</summary> */
+        public long Remaining;
+
+        /** <summary>Called when a burst is complete.  Must set Remaining for the next burst
+         * and then normally block, sleep or yield</summary> */
+        public Action<Simulator, SimThread> OnBurstEnd;
+
+        /** <summary>An event owned by this thread, for workloads which need one</summary> */
+        public Event Ev;
+
+        /** <summary>Workload specific state</summary> */
+        public int Group;
+        public SimThread Partner;
+        public int Pending = 0;         // signals received whilst not waiting for them
+
+        public long CpuTime = 0;
+        public long WakeTime = -1;      // time at which the thread became entitled to run
+        public int Dispatches = 0;
+    }
+
+    class SimCpu
+    {
+        public Cpu cpu;
+        public Scheduler sched;
+        public SimTimer timer;
+        public long IdleTime = 0;
+    }
+
+    class Simulator
+    {
+        public long Now = 0;
+        public long Step = 100000;      // 100 us
+        public long TickInterval = 10000000;    // 10 ms
+        public Random Rand;
+
+        public List<SimCpu> Cpus = new List<SimCpu>();
+        public List<SimThread> Threads = new List<SimThread>();
+        Dictionary<tysos.Thread, SimThread> map = new Dictionary<tysos.Thread, SimThread>();
+        SimSwitcher switcher;
+        SimCpu cur_cpu;
+
+        /* Statistics */
+        public List<long> Latencies = new List<long>();
+        public long Ticks = 0;
+        public long TickCost = 0;       // total host time spent in TimerTick, in ns
+        public long MaxTickCost = 0;
+        public long Picks = 0;
+        public long PickCost = 0;       // total host time spent choosing threads from system calls, in ns
+        Stopwatch sw = new Stopwatch();
+
+        public Simulator(int ncpus, bool nohz, int seed)
+        {
+            Rand = new Random(seed);
+
+            /* Reset the global kernel state from any previous run */
+            tysos.Program.arch = new Arch();
+            Scheduler.NoHz = nohz;
+            switcher = new SimSwitcher(this);
+            tysos.Program.arch.Switcher = switcher;
+
+            for (int i = 0; i < ncpus; i++)
+            {
+                SimCpu c = new SimCpu();
+                c.cpu = new Cpu();
+                c.cpu.Id = i;
+                c.timer = new SimTimer(this, TickInterval);
+                SimTimer t = c.timer;
+                c.cpu.OnKick = () => { t.kicked = true; };
+                c.cpu.CurrentTimer = c.timer;
+                tysos.Program.arch.Processors.Add(c.cpu);
+                Cpus.Add(c);
+            }
+            tysos.Program.arch.CurrentCpu = Cpus[0].cpu;
+
+            foreach (SimCpu c in Cpus)
+            {
+                c.sched = new Scheduler();
+                c.cpu.CurrentScheduler = c.sched;
+
+                /* Every cpu has an idle thread, as on the real system */
+                SimThread idle = AddThread("idle" + c.cpu.Id.ToString(), 0, null, c);
+                idle.Idle = true;
+                idle.Remaining = long.MaxValue;
+            }
+        }
+
+        /** <summary>Create a thread and make it runnable, on a particular cpu or spread across
+         * them round robin</summary> */
+        public SimThread AddThread(string name, int priority, Action<Simulator, SimThread> on_burst_end, SimCpu bind = null)
+        {
+            SimThread st = new SimThread();
+            st.t = new tysos.Thread();
+            st.t.name = name;
+            st.t.priority = priority;
+            st.OnBurstEnd = on_burst_end;
+            st.Ev = new Event();
+            Threads.Add(st);
+            map[st.t] = st;
+
+            SimCpu c = bind;
+            if (c == null)
+                c = Cpus[Threads.Count % Cpus.Count];
+            else
+                st.t.affinity = c.cpu;
+
+            Enter(c);
+            c.sched.Reschedule(st.t);
+            return st;
+        }
+
+        public SimThread Get(tysos.Thread t) { return map[t]; }
+
+        /** <summary>The cpu whose context we are currently simulating</summary> */
+        public SimCpu CurrentCpu { get { return cur_cpu; } }
+
+        void Enter(SimCpu c)
+        {
+            cur_cpu = c;
+            tysos.Program.arch.CurrentCpu = c.cpu;
+        }
+
+        internal void Dispatched(tysos.Thread t)
+        {
+            SimThread st = map[t];
+            st.Dispatches++;
+
+            /* A sleeping thread was entitled to run from the time its sleep was due to end */
+            long due;
+            if (sleep_due.TryGetValue(st, out due))
+            {
+                st.WakeTime = due;
+                sleep_due.Remove(st);
+            }
+
+            if (st.WakeTime >= 0)
+            {
+                long lat = Now - st.WakeTime;
+                Latencies.Add(lat < 0 ? 0 : lat);
+                st.WakeTime = -1;
+            }
+        }
+
+        /* The following mirror Syscalls.SchedulerFunctions for the thread running on the
+         * current cpu */
+
+        void PickNext(tysos.Thread cur)
+        {
+            sw.Restart();
+            tysos.Thread next = cur_cpu.sched.PickNextThread();
+            sw.Stop();
+            PickCost += sw.Elapsed.Ticks * 100;
+            Picks++;
+
+            if (next != cur && next != null)
+                switcher.Switch(next);
+            else if (next == cur)
+                Dispatched(cur);
+        }
+
+        /** <summary>Block the current thread on an event</summary> */
+        public void Block(SimThread st, Event e)
+        {
+            cur_cpu.sched.Block(st.t, e);
+            PickNext(st.t);
+        }
+
+        /** <summary>Put the current thread to sleep for ns nanoseconds</summary> */
+        public void Sleep(SimThread st, long ns)
+        {
+            st.WakeTime = -1;
+            cur_cpu.sched.Sleep(st.t, ns);
+            sleep_due[st] = Now + ns;
+            PickNext(st.t);
+        }
+
+        /** <summary>Give up the rest of the current thread's time slice</summary> */
+        public void Yield(SimThread st)
+        {
+            cur_cpu.sched.Reschedule(st.t);
+            PickNext(st.t);
+        }
+
+        /** <summary>Signal another thread.  If it is waiting on its event it is woken, otherwise
+         * the signal is counted so that it does not block next time (see WaitSignal)</summary> */
+        public void Signal(SimThread target)
+        {
+            if (target.t.location == tysos.Thread.LOC_WAITING)
+            {
+                if (target.WakeTime < 0)
+                    target.WakeTime = Now;
+                target.Ev.Set();
+            }
+            else
+                target.Pending++;
+        }
+
+        /** <summary>Wait for a signal from another thread, blocking only if none is pending</summary> */
+        public void WaitSignal(SimThread st)
+        {
+            if (st.Pending > 0)
+            {
+                st.Pending--;
+                return;
+            }
+            st.Ev.Reset();
+            Block(st, st.Ev);
+        }
+
+        Dictionary<SimThread, long> sleep_due = new Dictionary<SimThread, long>();
+
+        /** <summary>Make a newly created thread start off waiting for a signal</summary> */
+        public void StartWaiting(SimThread st)
+        {
+            st.Ev.Reset();
+            st.t.scheduler.Block(st.t, st.Ev);
+        }
+
+        /** <summary>Run the simulation for ns nanoseconds</summary> */
+        public void Run(long ns)
+        {
+            /* Start each cpu running something */
+            foreach (SimCpu c in Cpus)
+            {
+                Enter(c);
+                if (c.cpu.CurrentThread == null)
+                    PickNext(null);
+            }
+
+            long end = Now + ns;
+            while (Now < end)
+            {
+                Now += Step;
+
+                foreach (SimCpu c in Cpus)
+                {
+                    Enter(c);
+                    RunCurrent(c);
+                    CheckTimer(c);
+                }
+            }
+        }
+
+        void RunCurrent(SimCpu c)
+        {
+            tysos.Thread t = c.cpu.CurrentThread;
+            if (t == null)
+            {
+                c.IdleTime += Step;
+                return;
+            }
+
+            SimThread st = map[t];
+            if (st.Idle)
+            {
+                c.IdleTime += Step;
+                return;
+            }
+
+            long used = (st.Remaining < Step) ? st.Remaining : Step;
+            st.CpuTime += used;
+            st.Remaining -= used;
+            if (st.Remaining == 0 && st.OnBurstEnd != null)
+                st.OnBurstEnd(this, st);
+        }
+
+        void CheckTimer(SimCpu c)
+        {
+            if (!c.timer.kicked && (c.timer.next_fire < 0 || Now < c.timer.next_fire))
+                return;
+
+            long elapsed = c.timer.Fire();
+
+            sw.Restart();
+            c.sched.TimerTick(elapsed, c.cpu.CurrentThread, switcher);
+            sw.Stop();
+
+            long cost = sw.Elapsed.Ticks * 100;
+            TickCost += cost;
+            if (cost > MaxTickCost)
+                MaxTickCost = cost;
+            Ticks++;
+        }
+
+        /** <summary>Count the threads which have been entitled to run for more than grace ns
+         * without being switched to</summary> */
+        public int LostWakeups(long grace)
+        {
+            int ret = 0;
+            foreach (SimThread st in Threads)
+            {
+                if (st.WakeTime >= 0 && Now - st.WakeTime > grace)
+                    ret++;
+            }
+            foreach (long due in sleep_due.Values)
+            {
+                if (Now - due > grace)
+                    ret++;
+            }
+            return ret;
+        }
+    }
+}
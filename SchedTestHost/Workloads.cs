@@ -0,0 +1,124 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+using System;
+using System.Collections.Generic;
+using System.Text;
+
+namespace SchedTestHost
+{
+    /** <summary>Synthetic workloads.  Each sets up its threads in a fresh Simulator</summary> */
+    static class Workloads
+    {
+        public const int GROUP_CPUBOUND = 1;
+        public const int GROUP_PINGPONG = 2;
+        public const int GROUP_SLEEPER = 3;
+
+        public static readonly string[] Names = new string[] { "cpubound", "pingpong", "sleepstorm", "mixed" };
+
+        public static bool Setup(string name, Simulator sim, int threads)
+        {
+            switch (name)
+            {
+                case "cpubound":
+                    CpuBound(sim, threads, tysos.Thread.DEF_PRIORITY);
+                    return true;
+                case "pingpong":
+                    PingPong(sim, threads, tysos.Thread.DEF_PRIORITY);
+                    return true;
+                case "sleepstorm":
+                    SleepStorm(sim, threads, tysos.Thread.DEF_PRIORITY);
+                    return true;
+                case "mixed":
+                    /* Short lived sleepers run above the rest, which share the cpus */
+                    CpuBound(sim, threads / 4, tysos.Thread.DEF_PRIORITY);
+                    PingPong(sim, threads / 4, tysos.Thread.DEF_PRIORITY);
+                    SleepStorm(sim, threads - 2 * (threads / 4), tysos.Thread.DEF_PRIORITY + 2);
+                    return true;
+            }
+            return false;
+        }
+
+        /** <summary>Threads which never block.  Used to measure fairness of time slicing and
+         * load balancing</summary> */
+        static void CpuBound(Simulator sim, int n, int priority)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                SimThread st = sim.AddThread("cpu" + i.ToString(), priority, delegate (Simulator s, SimThread t)
+                {
+                    t.Remaining = 1000000000;
+                    s.Yield(t);
+                });
+                st.Group = GROUP_CPUBOUND;
+                st.Remaining = 1000000000;
+            }
+        }
+
+        /** <summary>Pairs of threads which repeatedly run a short burst, wake their partner and
+         * wait to be woken in turn, as a client and server do over RPC</summary> */
+        static void PingPong(Simulator sim, int n, int priority)
+        {
+            for (int i = 0; i + 1 < n; i += 2)
+            {
+                SimThread a = sim.AddThread("ping" + i.ToString(), priority, PingPongBurstEnd);
+                SimThread b = sim.AddThread("pong" + i.ToString(), priority, PingPongBurstEnd);
+                a.Partner = b;
+                b.Partner = a;
+                a.Group = b.Group = GROUP_PINGPONG;
+                a.Remaining = Burst(sim, 20000, 200000);
+
+                /* Only one of each pair starts with work to do */
+                b.Remaining = Burst(sim, 20000, 200000);
+                sim.StartWaiting(b);
+            }
+        }
+
+        static void PingPongBurstEnd(Simulator s, SimThread t)
+        {
+            t.Remaining = Burst(s, 20000, 200000);
+            s.Signal(t.Partner);
+            s.WaitSignal(t);
+        }
+
+        /** <summary>Threads which run very briefly and then sleep for between 1 and 500 ms, as
+         * drivers polling devices or waiting on retransmit timers do</summary> */
+        static void SleepStorm(Simulator sim, int n, int priority)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                SimThread st = sim.AddThread("sleep" + i.ToString(), priority, delegate (Simulator s, SimThread t)
+                {
+                    t.Remaining = Burst(s, 10000, 50000);
+                    s.Sleep(t, Burst(s, 1000000, 500000000));
+                });
+                st.Group = GROUP_SLEEPER;
+                st.Remaining = Burst(sim, 10000, 50000);
+            }
+        }
+
+        static long Burst(Simulator s, long min, long max)
+        {
+            return min + (long)(s.Rand.NextDouble() * (max - min));
+        }
+    }
+}
@@ -45,6 +45,12 @@ namespace tysos
         protected byte* cpu_alloc_current;
         protected byte* cpu_alloc_max;
 
+        /* Small object allocation buffer for gengc */
+        internal void* gc_alloc_buffer = null;
+
+        /* Free page magazines for PhysMem */
+        internal void* page_magazines = null;
+
         protected List<Resources.InterruptLine> interrupts = new List<Resources.InterruptLine>();
         virtual public ICollection<Resources.InterruptLine> Interrupts { get { return interrupts; } }
 
@@ -62,7 +68,12 @@ namespace tysos
         virtual internal Scheduler CurrentScheduler
         {
             get { return currentScheduler; }
-            set { currentScheduler = value; }
+            set
+            {
+                currentScheduler = value;
+                if (value != null)
+                    value.cpu = this;
+            }
         }
 
         virtual internal Timer CurrentTimer
@@ -71,6 +82,10 @@ namespace tysos
             set { currentTimer = value; }
         }
 
+        /** <summary>Interrupt this cpu (from another one) so that it runs its scheduler, e.g. when
+         * a thread has been made runnable on it whilst its tick is stopped</summary> */
+        virtual internal void Kick() { }
+
         virtual internal ulong IntPtrSize
         {
             get { return (ulong)libsupcs.OtherOperations.GetPointerSize(); }
@@ -71,9 +71,69 @@ namespace tysos
             }
         }
 
+        /* Threads waiting for this event to change state, created on demand */
+        Collections.Queue<Thread> waiters = null;
+
+        /** <summary>Can this event wake its waiters when it changes state?  If not, the
+         * scheduler has to poll IsSet</summary> */
+        protected virtual bool CanNotify { get { return Type == EventType.Standard; } }
+
+        /** <summary>Register a thread to be woken when this event changes state.  Returns
+         * false if the event cannot do this and needs to be polled instead</summary> */
+        internal virtual bool AddWaiter(Thread t)
+        {
+            if (!CanNotify)
+                return false;
+
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock (this)
+            {
+                if (waiters == null)
+                    waiters = new Collections.Queue<Thread>();
+                if (!waiters.Contains(t))
+                    waiters.Add(t);
+            }
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return true;
+        }
+
+        internal virtual void RemoveWaiter(Thread t)
+        {
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock (this)
+            {
+                if (waiters != null)
+                    waiters.Remove(t);
+            }
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+        }
+
+        /** <summary>Ask the scheduler to re-examine all threads waiting on this event</summary> */
+        protected void Notify()
+        {
+            /* Detach the whole wait queue first: threads which are still not able to
+             * continue will re-register themselves */
+            Collections.Queue<Thread> w;
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock (this)
+            {
+                w = waiters;
+                waiters = null;
+            }
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+
+            if (w == null)
+                return;
+
+            Thread t;
+            while ((t = w.GetFirst()) != null)
+                Scheduler.Wake(t);
+        }
+
         public virtual void Set()
         {
             mutex = 1;
+            Notify();
         }
 
         public virtual void Reset()
@@ -82,6 +142,37 @@ namespace tysos
         }
     }
 
+    /** <summary>Set whilst a process has messages waiting in its IPC buffer.  IPC.SendMessage
+     * notifies it</summary> */
+    public class MessageEvent : Event
+    {
+        Process p;
+
+        public MessageEvent(Process _p)
+        {
+            p = _p;
+            name = "BlockOnMessage";
+        }
+
+        public override bool IsSet
+        {
+            get
+            {
+                if (p.ipc == null)
+                    return false;
+                return p.ipc.PeekMessage() != null;
+            }
+        }
+
+        public override void Set()
+        {
+            Notify();
+        }
+
+        public override void Reset()
+        { }
+    }
+
     public class MultipleEvent : Event
     {
         public List<Event> Children = new List<Event>();
@@ -90,6 +181,28 @@ namespace tysos
         { }
         public override void Reset()
         { }
+
+        /* We are woken by any of our children changing state.  If any of them has to be
+         * polled then so do we, so undo the registrations already made with the others */
+        internal override bool AddWaiter(Thread t)
+        {
+            for (int i = 0; i < Children.Count; i++)
+            {
+                if (!Children[i].AddWaiter(t))
+                {
+                    for (int j = 0; j < i; j++)
+                        Children[j].RemoveWaiter(t);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        internal override void RemoveWaiter(Thread t)
+        {
+            foreach (Event e in Children)
+                e.RemoveWaiter(t);
+        }
     }
 
     public class WaitAnyEvent : MultipleEvent
@@ -159,6 +272,8 @@ namespace tysos
 
         public ProcessEventTypeKind ProcessEventType;
 
+        protected override bool CanNotify { get { return false; } }
+
         public override bool IsSet
         {
             get
@@ -177,7 +292,13 @@ namespace tysos
     {
         long limit_val;
         Timer timer;
+        TimerWheel.Timeout timeout = null;
 
+        /* If we could arm a timeout on the current cpu's timer wheel then it sets us when
+         * it expires, otherwise we have to be polled */
+        protected override bool CanNotify { get { return timeout != null; } }
+
+        /** <summary>Create an event which becomes set after tick_delay timer ticks (of 100 ns)</summary> */
         public TimerEvent(long tick_delay)
         {
             timer = Program.arch.CurrentCpu.CurrentTimer;
@@ -185,6 +306,25 @@ namespace tysos
             {
                 limit_val = timer.Ticks + tick_delay;
             }
+
+            Scheduler s = Program.arch.CurrentCpu.CurrentScheduler;
+            if (s != null)
+            {
+                timeout = new TimerWheel.Timeout(Expired, this);
+                s.timers.Add(timeout, tick_delay * 100);
+            }
+        }
+
+        static void Expired(object o)
+        {
+            ((TimerEvent)o).Set();
+        }
+
+        /** <summary>Stop the underlying timeout, if the event is no longer required</summary> */
+        public void Cancel()
+        {
+            if (timeout != null)
+                timeout.Cancel();
         }
 
         public override bool IsSet
@@ -199,6 +339,8 @@ namespace tysos
                 Formatter.WriteLine(Program.arch.DebugOutput);
 #endif
 
+                if (mutex == 1)
+                    return true;
                 if (timer.Ticks > limit_val)
                     return true;
                 return false;
@@ -211,6 +353,8 @@ namespace tysos
         public delegate bool EventDelegate();
         EventDelegate d;
 
+        protected override bool CanNotify { get { return false; } }
+
         public DelegateEvent(EventDelegate _function)
         {
             d = _function;
@@ -231,6 +375,8 @@ namespace tysos
         ParameterEventDelegate d;
         object obj;
 
+        protected override bool CanNotify { get { return false; } }
+
         public DelegateWithParameterEvent(ParameterEventDelegate _function, object o)
         {
             d = _function;
@@ -58,6 +58,10 @@ namespace tysos
 
         public Event result;
         public bool EventSetsOnReturn = true;
+
+        /* Priority lent by the caller to the server thread for the duration of the call */
+        public Thread DonatedTo = null;
+        public int DonatedPriority = -1;
     }
 
     unsafe class IPC
@@ -129,7 +133,14 @@ namespace tysos
             if (!ready)
                 return false;
 
-            return rb.Enqueue((IntPtr)libsupcs.CastOperations.ReinterpretAsPointer(message));
+            if (!rb.Enqueue((IntPtr)libsupcs.CastOperations.ReinterpretAsPointer(message)))
+                return false;
+
+            /* Wake any threads of the receiving process blocked waiting for messages */
+            if (owning_process.msg_event != null)
+                owning_process.msg_event.Set();
+
+            return true;
         }
 
         bool ready;
@@ -24,11 +24,16 @@ namespace tysos
      *  is 2048 entries * 2 = 4096 entries)
      *  
      * 
-     * Each individual buddy level is a stack rather than a bitmap (for fast access),
-     *  therefore coalescing is not permitted (it is presumed that device buffers will
-     *  only be allocated once).
+     * The stack based regions (PmemStack, PmemTwoLevelStack) keep each level as a stack
+     *  rather than a bitmap (for fast access), therefore coalescing is not permitted.
      * Using the RingBuffer<> class we can make everything lock free.
      * 
+     * PmemBuddy is a true binary buddy allocator with every power of 2 from 4 kiB to
+     *  1 GiB.  Free buddies are coalesced on release, so long running systems can still
+     *  satisfy large contiguous requests.  The buddy lists are protected by a spinlock.
+     *  Single pages (by far the most common request) are cached in the per-cpu magazines
+     *  below, which move them to and from the regions in batches under a single lock.
+     * 
      * If a request is made for a region of a particular size, first the smallest possible
      *  region size equal to or greater than the request size is identified
      * 
@@ -71,6 +76,328 @@ namespace tysos
             }
         }
 
+        /* Copy-on-write reference counts.
+         * 
+         * A page mapped copy-on-write at more than one address has a count of those
+         *  mappings in its region's metadata.  A count of 0 means that it has a single
+         *  owner, who may write to it in place.  The blank page is never counted or freed,
+         *  and writes to it always take a fresh page.
+         */
+
+        /** <summary>Location of the reference count for paddr, or null if the page
+         * cannot be shared</summary> */
+        protected virtual int* get_refcount(nuint paddr)
+        {
+            return null;
+        }
+
+        /** <summary>Take a reference on paddr for a new copy-on-write mapping.  Returns
+         * false if the page cannot be shared, in which case the caller must copy
+         * it</summary> */
+        public bool SharePage(nuint paddr)
+        {
+            if (paddr == BlankPage)
+                return true;
+            int* rc = get_refcount(paddr);
+            if (rc == null)
+                return false;
+
+            while (true)
+            {
+                int old = *rc;
+                int nv = old == 0 ? 2 : old + 1;
+                if (nv < 0)
+                    return false;
+                if (System.Threading.Interlocked.CompareExchange(ref *rc, nv, old) == old)
+                    return true;
+            }
+        }
+
+        /** <summary>Drop a mapping's reference on paddr.  Returns true if it was the only
+         * one, in which case the caller owns the page outright</summary> */
+        public bool UnsharePage(nuint paddr)
+        {
+            if (paddr == BlankPage)
+                return false;
+            int* rc = get_refcount(paddr);
+            if (rc == null)
+                return true;
+
+            while (true)
+            {
+                int old = *rc;
+                if (old == 0)
+                    return true;
+                int nv = old == 2 ? 0 : old - 1;
+                if (System.Threading.Interlocked.CompareExchange(ref *rc, nv, old) == old)
+                    return false;
+            }
+        }
+
+        /** <summary>Is paddr mapped at more than one address?</summary> */
+        public bool IsShared(nuint paddr)
+        {
+            if (paddr == BlankPage)
+                return true;
+            int* rc = get_refcount(paddr);
+            return rc != null && *rc != 0;
+        }
+
+        /** <summary>Release a page which has just been unmapped, unless it is the blank
+         * page or is still mapped elsewhere</summary> */
+        public void ReleaseMapped(nuint paddr)
+        {
+            if (UnsharePage(paddr))
+                Release(paddr, psize);
+        }
+
+        /* Per-cpu page magazines.
+         * 
+         * Each cpu holds two magazines of free single pages: hot, which page allocation
+         *  and release use, and cold.  When hot is empty it is swapped with cold if that
+         *  has anything in it, else refilled from the global allocator.  When hot is full,
+         *  cold is drained to the global allocator and the two are swapped.  Thus a cpu
+         *  only visits the global allocator once per magazine of pages, and recently
+         *  released (cache warm) pages are reused first.
+         *  
+         * Only the owning cpu touches its magazines, with interrupts disabled, so no
+         *  locking is required.
+         */
+        const int mag_rounds = 64;
+        const nuint psize = 0x1000;
+
+        struct page_magazines
+        {
+            public nuint* hot;
+            public nuint* cold;
+            public int hot_count;
+            public int cold_count;
+        }
+
+        /** <summary>Take up to count single pages from the global allocator.  Returns the
+         * number obtained</summary> */
+        protected abstract int AllocatePages(nuint* pages, int count);
+
+        /** <summary>Return a batch of single pages to the global allocator</summary> */
+        protected abstract void ReleasePages(nuint* pages, int count);
+
+        page_magazines* get_magazines(Cpu cpu)
+        {
+            var m = (page_magazines*)cpu.page_magazines;
+            if (m != null)
+                return m;
+
+            // The magazines and their header fit in a single page
+            nuint p;
+            if (AllocatePages(&p, 1) != 1)
+                return null;
+            m = (page_magazines*)vmem.Map(p, psize, 0, 0).vaddr;
+            m->hot = (nuint*)((byte*)m + sizeof(page_magazines));
+            m->cold = m->hot + mag_rounds;
+            m->hot_count = 0;
+            m->cold_count = 0;
+            cpu.page_magazines = m;
+            return m;
+        }
+
+        static void swap_magazines(page_magazines* m)
+        {
+            var t = m->hot;
+            m->hot = m->cold;
+            m->cold = t;
+            var tc = m->hot_count;
+            m->hot_count = m->cold_count;
+            m->cold_count = tc;
+        }
+
+        /** <summary>Get a single page from the current cpu's magazines.  Returns 0 if
+         * there is no current cpu yet or the global allocator is empty</summary> */
+        protected nuint magazine_get_page()
+        {
+            nuint ret = 0;
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+            Cpu cpu = Program.arch.CurrentCpu;
+            if (cpu != null)
+            {
+                var m = get_magazines(cpu);
+                if (m != null)
+                {
+                    if (m->hot_count == 0)
+                    {
+                        if (m->cold_count != 0)
+                            swap_magazines(m);
+                        else
+                            m->hot_count = AllocatePages(m->hot, mag_rounds);
+                    }
+                    if (m->hot_count != 0)
+                        ret = m->hot[--m->hot_count];
+                }
+            }
+
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return ret;
+        }
+
+        /** <summary>Return a single page to the current cpu's magazines.  Returns false
+         * if there is no current cpu yet, in which case the caller should release it
+         * globally</summary> */
+        protected bool magazine_put_page(nuint paddr)
+        {
+            bool ret = false;
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+            Cpu cpu = Program.arch.CurrentCpu;
+            if (cpu != null)
+            {
+                var m = get_magazines(cpu);
+                if (m != null)
+                {
+                    if (m->hot_count == mag_rounds)
+                    {
+                        ReleasePages(m->cold, m->cold_count);
+                        m->cold_count = 0;
+                        swap_magazines(m);
+                    }
+                    m->hot[m->hot_count++] = paddr;
+                    ret = true;
+                }
+            }
+
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return ret;
+        }
+
+        /** <summary>Return everything in the current cpu's magazines to the global
+         * allocator, so that a contiguous allocation which failed can be retried.  Returns
+         * false if there was nothing to return</summary> */
+        protected bool magazine_flush()
+        {
+            bool ret = false;
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+            Cpu cpu = Program.arch.CurrentCpu;
+            if (cpu != null)
+            {
+                var m = (page_magazines*)cpu.page_magazines;
+                if (m != null && (m->hot_count != 0 || m->cold_count != 0))
+                {
+                    ReleasePages(m->hot, m->hot_count);
+                    ReleasePages(m->cold, m->cold_count);
+                    m->hot_count = 0;
+                    m->cold_count = 0;
+                    ret = true;
+                }
+            }
+
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return ret;
+        }
+
+        /* Pre-zeroed page pool.
+         * 
+         * GetPage has to return zeroed pages, and clearing them on demand puts the cost
+         *  on the page fault path.  Instead an idle priority thread keeps a lock-free pool
+         *  of zeroed pages topped up.  Taking a page sets zero_pool_low whenever the pool
+         *  falls below a quarter full, which wakes the thread to refill it.
+         *  The pages are unlikely to be touched again soon, so architectures should
+         *  override ClearPage to avoid filling the cache with them.
+         */
+        Collections.RingBuffer<nuint> zero_pool = null;
+        Event zero_pool_low = null;
+        const int zero_pool_entries = 512;
+        const int zero_pool_low_water = zero_pool_entries / 4;
+        const long zero_pool_retry = 10000000;     // ns to wait if memory is exhausted
+
+        /** <summary>Take a page from the pool of zeroed pages.  Returns 0 if it is
+         * empty</summary> */
+        protected nuint zero_pool_get_page()
+        {
+            var zp = zero_pool;
+            if (zp == null)
+                return 0;
+
+            bool got = zp.Dequeue(out var ret);
+            if (zp.Count < zero_pool_low_water && !zero_pool_low.IsSet)
+                zero_pool_low.Set();
+            return got ? ret : 0;
+        }
+
+        protected nuint zero_pool_free_space()
+        {
+            var zp = zero_pool;
+            if (zp == null)
+                return 0;
+            return (nuint)zp.Count * psize;
+        }
+
+        /** <summary>Zero a page for the pool</summary> */
+        protected virtual void ClearPage(nuint paddr)
+        {
+            libsupcs.MemoryOperations.MemSet((void*)vmem.Map(paddr, psize, 0, 0).vaddr, 0, (int)psize);
+        }
+
+        /** <summary>Keeps the pool of zeroed pages topped up.  Runs at idle
+         * priority</summary> */
+        public void ZeroPageThreadProc()
+        {
+            // The pool itself occupies a single page
+            var p = Allocate(psize);
+            if (p == 0)
+                return;
+            var zp = new Collections.RingBuffer<nuint>((void*)vmem.Map(p, psize, 0, 0).vaddr,
+                zero_pool_entries * sizeof(nuint));
+            var low = new Event();
+            low.name = "zero_pool_low";
+            zero_pool_low = low;
+            zero_pool = zp;
+
+            while (true)
+            {
+                // A ring buffer holds one less than its length
+                while (zp.Count < zero_pool_entries - 1)
+                {
+                    var page = Allocate(psize);
+                    if (page == 0)
+                    {
+                        Syscalls.SchedulerFunctions.Sleep(zero_pool_retry);
+                        break;
+                    }
+                    ClearPage(page);
+                    if (!zp.Enqueue(page))
+                    {
+                        Release(page, psize);
+                        break;
+                    }
+                }
+
+                /* Only reset the event after refilling, then look again in case pages were
+                 * taken in the meantime */
+                low.Reset();
+                if (zp.Count < zero_pool_low_water)
+                    continue;
+                Syscalls.SchedulerFunctions.Block(low);
+            }
+        }
+
+        /** <summary>Free space held in all cpus' magazines.  This is approximate as other
+         * cpus may be using theirs</summary> */
+        protected nuint magazine_free_space()
+        {
+            var cpus = Program.arch.Processors;
+            if (cpus == null)
+                return 0;
+
+            nuint ret = 0;
+            foreach (Cpu cpu in cpus)
+            {
+                var m = (page_magazines*)cpu.page_magazines;
+                if (m != null)
+                    ret += (nuint)(m->hot_count + m->cold_count) * psize;
+            }
+            return ret;
+        }
+
         abstract protected class PmemRegion
         {
             public PmemRegion next;
@@ -82,6 +409,33 @@ namespace tysos
             public abstract nuint AllocateFixed(nuint paddr, nuint len);
             public abstract nuint FreeSpace { get; }
 
+            /** <summary>Location of the copy-on-write reference count for paddr, or null
+             *   if this region does not keep them</summary> */
+            public virtual int* RefCount(nuint paddr) { return null; }
+
+            /** <summary>Take up to count single pages.  Returns the number
+             *   obtained</summary> */
+            public virtual int AllocatePages(nuint* pages, int count)
+            {
+                int n = 0;
+                while (n < count)
+                {
+                    var p = Allocate(psize);
+                    if (p == 0)
+                        break;
+                    pages[n++] = p;
+                }
+                return n;
+            }
+
+            /** <summary>Return a batch of single pages, all of which lie within this
+             *   region</summary> */
+            public virtual void ReleasePages(nuint* pages, int count)
+            {
+                for (int i = 0; i < count; i++)
+                    Release(pages[i], psize);
+            }
+
             public virtual nuint StartAddr { get; protected set; }
             public virtual nuint Length { get; protected set; }
             public virtual nuint EndAddr { get { return StartAddr + Length; } }
@@ -181,7 +535,8 @@ namespace tysos
 
             public override void Release(nuint paddr, nuint len)
             {
-                throw new NotImplementedException();
+                for (nuint x = paddr; x + ssize <= paddr + len; x += ssize)
+                    rbs.Enqueue(x);
             }
 
             public override nuint Allocate(nuint len)
@@ -267,7 +622,23 @@ namespace tysos
 
             public override void Release(nuint paddr, nuint len)
             {
-                throw new NotImplementedException();
+                /* Whole large pages go back on the large stack.  Anything else is returned as
+                 * small pages, which are not recombined. */
+                var lmask = lsize - 1;
+                nuint x = paddr;
+                while (x + ssize <= paddr + len)
+                {
+                    if ((x & lmask) == 0 && x + lsize <= paddr + len)
+                    {
+                        rbl.Enqueue(x);
+                        x += lsize;
+                    }
+                    else
+                    {
+                        rbs.Enqueue(x);
+                        x += ssize;
+                    }
+                }
             }
 
             public override nuint Allocate(nuint len)
@@ -326,6 +697,356 @@ namespace tysos
 
             public override ulong FreeSpace => (ulong)rbs.Count * ssize + (ulong)rbl.Count * lsize;
         }
+
+        /** <summary>Binary buddy allocator with coalescing</summary> */
+        protected class PmemBuddy : PmemRegion
+        {
+            const int max_orders = 19;      // ssize << 18 = 1 GiB for 4 kiB pages
+            const uint nil = uint.MaxValue;
+            const byte bp_free = 1;
+
+            /** <summary>Per-page metadata.  Only the first page of a free block is
+             *   meaningful; it is linked into free_heads[order]</summary> */
+            struct buddy_page
+            {
+                public uint next, prev;
+                public byte order;
+                public byte flags;
+                public int refs;        // copy-on-write mappings of an allocated page
+            }
+
+            nuint ssize;
+            int max_order;
+
+            /* Block indices are relative to bbase, which is aligned to the largest block
+             *  size, so that a block of order k is naturally aligned to ssize << k.  pages
+             *  is biased so that pages[first_idx] is the entry for StartAddr. */
+            nuint bbase;
+            uint first_idx, end_idx;
+            buddy_page* pages;
+            uint[] free_heads = new uint[max_orders];
+            nuint free_pages = 0;
+            int buddy_lock = 0;
+
+            public PmemBuddy(PhysMem _pmem, nuint paddrbase, nuint len,
+                nuint _ssize = 4096)
+            {
+                pmem = _pmem;
+                ssize = _ssize;
+
+                // The page metadata goes at the start of the region
+                nuint npages = len / ssize;
+                nuint mbasep = paddrbase;
+                nuint mlen = npages * (nuint)sizeof(buddy_page);
+
+                nuint x = first_page(paddrbase, len, ssize);
+                StartAddr = x;
+                if (x < paddrbase + len)
+                    Length = (paddrbase + len - x) & ~(ssize - 1);
+                else
+                    Length = 0;
+
+                // Largest block that fits within the region
+                max_order = 0;
+                while (max_order < max_orders - 1 && (ssize << (max_order + 1)) <= Length)
+                    max_order++;
+
+                bbase = StartAddr & ~((ssize << max_order) - 1);
+                first_idx = (uint)((StartAddr - bbase) / ssize);
+                end_idx = first_idx + (uint)(Length / ssize);
+                pages = (buddy_page*)pmem.vmem.Map(mbasep, mlen, 0, 0).vaddr - first_idx;
+
+                // Free list membership is decided from the flags, so they must start clear
+                libsupcs.MemoryOperations.MemSet(&pages[first_idx], 0, (int)((end_idx - first_idx) * (uint)sizeof(buddy_page)));
+
+                for (int i = 0; i < max_orders; i++)
+                    free_heads[i] = nil;
+                free_range(first_idx, end_idx);
+
+                // Debug
+                Formatter.Write("PmemBuddy: free pages ", Program.arch.DebugOutput);
+                Formatter.Write((ulong)free_pages, Program.arch.DebugOutput);
+                Formatter.Write(", max order ", Program.arch.DebugOutput);
+                Formatter.Write((ulong)max_order, Program.arch.DebugOutput);
+                Formatter.WriteLine(Program.arch.DebugOutput);
+            }
+
+            /** <summary>The first page of a region made from [paddrbase, paddrbase + len),
+             *   after its metadata</summary> */
+            static nuint first_page(nuint paddrbase, nuint len, nuint ssize)
+            {
+                return util.align(paddrbase + len / ssize * (nuint)sizeof(buddy_page), ssize);
+            }
+
+            /** <summary>Is [paddrbase, paddrbase + len) large enough for a region, i.e. to
+             *   hold its metadata and at least one page?</summary> */
+            public static bool CanHold(nuint paddrbase, nuint len, nuint ssize = 4096)
+            {
+                return first_page(paddrbase, len, ssize) + ssize <= paddrbase + len;
+            }
+
+            uint to_idx(nuint paddr) { return (uint)((paddr - bbase) / ssize); }
+            nuint to_paddr(uint idx) { return bbase + (nuint)idx * ssize; }
+
+            void lock_buddy()
+            {
+                while (System.Threading.Interlocked.CompareExchange(ref buddy_lock, 1, 0) != 0) ;
+            }
+
+            void unlock_buddy()
+            {
+                buddy_lock = 0;
+            }
+
+            /** <summary>Push a block on to its free list.  Called with the lock held</summary> */
+            void add_free(uint idx, int order)
+            {
+                var p = &pages[idx];
+                p->order = (byte)order;
+                p->flags = bp_free;
+                p->prev = nil;
+                p->next = free_heads[order];
+                if (p->next != nil)
+                    pages[p->next].prev = idx;
+                free_heads[order] = idx;
+                free_pages += (nuint)1 << order;
+            }
+
+            /** <summary>Unlink a free block from its free list.  Called with the lock
+             *   held</summary> */
+            void remove_free(uint idx)
+            {
+                var p = &pages[idx];
+                if (p->prev != nil)
+                    pages[p->prev].next = p->next;
+                else
+                    free_heads[p->order] = p->next;
+                if (p->next != nil)
+                    pages[p->next].prev = p->prev;
+                p->flags = 0;
+                free_pages -= (nuint)1 << p->order;
+            }
+
+            /** <summary>Add [idx, end) as the largest naturally aligned blocks possible,
+             *   without coalescing with neighbours.  Called with the lock held</summary> */
+            void free_range(uint idx, uint end)
+            {
+                while (idx < end)
+                {
+                    int k = max_order;
+                    while (k > 0 && ((idx & ((1U << k) - 1)) != 0 || idx + (1U << k) > end))
+                        k--;
+                    add_free(idx, k);
+                    idx += 1U << k;
+                }
+            }
+
+            /** <summary>Return a block, merging it with its buddy for as long as the buddy
+             *   is free.  Called with the lock held</summary> */
+            void free_block(uint idx, int order)
+            {
+                while (order < max_order)
+                {
+                    uint buddy = idx ^ (1U << order);
+                    if (buddy < first_idx || buddy + (1U << order) > end_idx)
+                        break;
+                    if (pages[buddy].flags != bp_free || pages[buddy].order != order)
+                        break;
+                    remove_free(buddy);
+                    idx &= ~(1U << order);
+                    order++;
+                }
+                add_free(idx, order);
+            }
+
+            /** <summary>Return an arbitrary page range, coalescing as we go.  Called with
+             *   the lock held</summary> */
+            void release_range(uint idx, uint end)
+            {
+                while (idx < end)
+                {
+                    int k = max_order;
+                    while (k > 0 && ((idx & ((1U << k) - 1)) != 0 || idx + (1U << k) > end))
+                        k--;
+                    free_block(idx, k);
+                    idx += 1U << k;
+                }
+            }
+
+            /** <summary>Take a block of the given order, splitting larger ones as
+             *   required.  Called with the lock held</summary> */
+            uint alloc_order(int order)
+            {
+                int j = order;
+                while (j <= max_order && free_heads[j] == nil)
+                    j++;
+                if (j > max_order)
+                    return nil;
+
+                uint idx = free_heads[j];
+                remove_free(idx);
+                while (j > order)
+                {
+                    j--;
+                    add_free(idx + (1U << j), j);
+                }
+                return idx;
+            }
+
+            /** <summary>Find the free block containing page idx, or nil.  Called with the
+             *   lock held</summary> */
+            uint find_free_head(uint idx)
+            {
+                for (int k = 0; k <= max_order; k++)
+                {
+                    uint head = idx & ~((1U << k) - 1);
+                    if (head < first_idx)
+                        break;
+                    if (pages[head].flags == bp_free && pages[head].order == k)
+                        return head;
+                }
+                return nil;
+            }
+
+            bool range_free(uint idx, uint end)
+            {
+                while (idx < end)
+                {
+                    uint head = find_free_head(idx);
+                    if (head == nil)
+                        return false;
+                    idx = head + (1U << pages[head].order);
+                }
+                return true;
+            }
+
+            public override int AllocatePages(nuint* pages, int count)
+            {
+                int n = 0;
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+                lock_buddy();
+
+                while (n < count)
+                {
+                    uint idx = alloc_order(0);
+                    if (idx == nil)
+                        break;
+                    pages[n++] = to_paddr(idx);
+                }
+
+                unlock_buddy();
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                return n;
+            }
+
+            public override void ReleasePages(nuint* pages, int count)
+            {
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+                lock_buddy();
+                for (int i = 0; i < count; i++)
+                    free_block(to_idx(pages[i]), 0);
+                unlock_buddy();
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            }
+
+            public override nuint Allocate(nuint len)
+            {
+                // Smallest block which covers len
+                nuint npages = util.align(len, ssize) / ssize;
+                int order = 0;
+                while (((nuint)1 << order) < npages)
+                    order++;
+                if (order > max_order)
+                    return 0;
+
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+                lock_buddy();
+
+                uint idx = alloc_order(order);
+
+                // Give back the unused tail of the block
+                if (idx != nil && npages < ((nuint)1 << order))
+                    release_range(idx + (uint)npages, idx + (1U << order));
+
+                unlock_buddy();
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+
+                return idx == nil ? 0 : to_paddr(idx);
+            }
+
+            public override nuint AllocateFixed(nuint paddr, nuint len)
+            {
+                nuint start = paddr & ~(ssize - 1);
+                nuint end = util.align(paddr + len, ssize);
+                if (start < StartAddr || end > EndAddr || start >= end)
+                    return 0;
+
+                uint s = to_idx(start);
+                uint e = to_idx(end);
+
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+                lock_buddy();
+
+                if (!range_free(s, e))
+                {
+                    unlock_buddy();
+                    libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                    return 0;
+                }
+
+                // Remove each covering block and give back the parts outside [s, e)
+                uint x = s;
+                while (x < e)
+                {
+                    uint head = find_free_head(x);
+                    uint bend = head + (1U << pages[head].order);
+                    remove_free(head);
+                    if (head < x)
+                        free_range(head, x);
+                    if (bend > e)
+                        free_range(e, bend);
+                    x = bend;
+                }
+
+                unlock_buddy();
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+
+                return start;
+            }
+
+            public override void Release(nuint paddr, nuint len)
+            {
+                if (len <= ssize)
+                {
+                    ReleasePages(&paddr, 1);
+                    return;
+                }
+
+                nuint start = util.align(paddr, ssize);
+                nuint end = (paddr + len) & ~(ssize - 1);
+                if (start < StartAddr)
+                    start = StartAddr;
+                if (end > EndAddr)
+                    end = EndAddr;
+                if (start >= end)
+                    return;
+
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+                lock_buddy();
+                release_range(to_idx(start), to_idx(end));
+                unlock_buddy();
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            }
+
+            public override int* RefCount(nuint paddr)
+            {
+                if (paddr < StartAddr || paddr >= EndAddr)
+                    return null;
+                return &pages[to_idx(paddr)].refs;
+            }
+
+            public override ulong FreeSpace => (ulong)free_pages * ssize;
+        }
     }
 
     public abstract class PageProvider
@@ -47,6 +47,7 @@ namespace tysos
 
             p.startup_thread = Thread.Create(name + "(Thread 1)", e_point, stack_size, tls_size, vreg, stab, parameters);
             p.startup_thread.owning_process = p;
+            p.msg_event = new MessageEvent(p);
             p.threads.Add(p.startup_thread);
             p.name = name;
 
@@ -65,6 +66,7 @@ namespace tysos
 
         internal Virtual_Regions.Region ipc_region;
         internal IPC ipc;
+        internal MessageEvent msg_event;
 
         public static Process CreateProcess(lib.File file, string name, object [] parameters)
         {
@@ -97,12 +99,47 @@ namespace tysos
         internal const int LOC_SLEEPING = -2;
         internal const int LOC_BLOCKING = -3;
         internal const int LOC_RELEASED = -4;
+        internal const int LOC_WAITING = -5;
+        internal const int LOC_DEADLINE = -6;       // runnable deadline thread
+        internal const int LOC_THROTTLED = -7;      // deadline thread which has used up its runtime
 
         internal int location = LOC_RELEASED;
         internal int priority = DEF_PRIORITY;
         internal long time_to_run;
         internal long default_slice = DEF_SLICE;
 
+        internal Scheduler scheduler = null;    // scheduler whose queues currently hold this thread
+        internal Thread rq_next, rq_prev;       // links within a Scheduler.RunQueue
+        internal Cpu affinity = null;           // if set, the thread may only run on this cpu
+        internal TimerWheel.Timeout sleep_timeout;  // armed whilst the thread is LOC_SLEEPING
+
+        /* Priorities donated by other threads, e.g. callers waiting on an RPC we are handling.
+         * Bit n of donated_mask is set whilst donated_count[n] is non-zero.  Protected by
+         * lock (this) */
+        internal uint donated_mask = 0;
+        internal int[] donated_count = null;
+        internal long donated_slice = 0;        // largest time slice donated
+
+        /* Deadline scheduling parameters (in ns).  dl_period is zero for ordinary threads */
+        internal long dl_runtime = 0;
+        internal long dl_period = 0;
+        internal long dl_deadline = 0;
+        internal long dl_bw = 0;                    // dl_runtime / dl_period, scaled by 1 << Scheduler.DL_BW_SHIFT
+        internal long dl_abs_deadline = 0;          // current deadline, in the time of the owning scheduler's timers
+        internal long dl_remaining = 0;             // runtime left before dl_abs_deadline
+        internal TimerWheel.Timeout dl_timeout;     // armed whilst LOC_THROTTLED
+        internal Cpu dl_saved_affinity = null;      // affinity to restore when the reservation is released
+
+        /** <summary>The priority the thread is scheduled at, including any donated to it</summary> */
+        internal int EffectivePriority
+        {
+            get
+            {
+                int d = util.HighestSetBit(donated_mask);
+                return (d > priority) ? d : priority;
+            }
+        }
+
         internal int thread_id;
         internal TaskSwitchInfo saved_state;
         public Process owning_process;
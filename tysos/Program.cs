@@ -185,32 +185,52 @@ namespace tysos
                 Formatter.WriteLine("done", arch.BootInfoOutput);
             }
 
-            /* Start the scheduler */
+            /* Start the scheduler - each cpu has its own set of run queues */
             Formatter.Write("Starting scheduler... ", arch.DebugOutput);
-            arch.CurrentCpu.CurrentScheduler = new Scheduler();
+            foreach (Cpu cpu in arch.Processors)
+                cpu.CurrentScheduler = new Scheduler();
             if (GetCmdLine("ignore_timer") == false)
+            {
                 arch.SchedulerTimer.Callback = new Timer.TimerCallback(Scheduler.TimerProc);
+                if (GetCmdLine("nohz") && arch.SchedulerTimer.SupportsOneShot)
+                    Scheduler.NoHz = true;
+            }
             Formatter.WriteLine("done", arch.DebugOutput);
 
             /* Store the process info */
             running_processes = new Dictionary<string, Process>(new MyGenericEqualityComparer<string>());
 
-            /* Add in threads for GC collections */
+            /* Add in threads for GC collections.  Minor and incremental collections rely on
+             * the write barrier being emitted for every reference store. */
             Formatter.Write("Starting GC collection threads... ", arch.DebugOutput);
-            Thread t_max = Thread.Create("gc_max_alloc", new System.Threading.ThreadStart(gc.gengc.MaxAllocCollectThreadProc),
+            if (GetCmdLine("gengc_minor"))
+                gc.gengc.MinorCollections = true;
+            if (GetCmdLine("gengc_incremental"))
+                gc.gengc.IncrementalCollections = true;
+            if (GetCmdLine("gctrace"))
+                gc.gc.TraceAllocations = true;
+            Thread t_trigger = Thread.Create("gc_alloc_trigger", new System.Threading.ThreadStart(gc.gengc.AllocTriggerCollectThreadProc),
                 new object[] { });
-            t_max.priority = 10;
-            arch.CurrentCpu.CurrentScheduler.Reschedule(t_max);
+            t_trigger.priority = 10;
+            arch.CurrentCpu.CurrentScheduler.Reschedule(t_trigger);
 
-            Thread t_min = Thread.Create("gc_min_alloc", new System.Threading.ThreadStart(gc.gengc.MinAllocCollectThreadProc),
+            Thread t_idle = Thread.Create("gc_idle", new System.Threading.ThreadStart(gc.gengc.IdleCollectThreadProc),
                 new object[] { });
-            t_min.priority = 0;
-            arch.CurrentCpu.CurrentScheduler.Reschedule(t_min);
+            t_idle.priority = 0;
+            arch.CurrentCpu.CurrentScheduler.Reschedule(t_idle);
 
             Thread t_request = Thread.Create("gc_request", new System.Threading.ThreadStart(gc.gengc.OnRequestCollectThreadProc),
                 new object[] { });
-            t_min.priority = 10;
+            t_request.priority = 10;
             arch.CurrentCpu.CurrentScheduler.Reschedule(t_request);
+
+            Thread t_sweep = Thread.Create("gc_sweep", new System.Threading.ThreadStart(gc.gengc.LazySweepThreadProc),
+                new object[] { });
+            t_sweep.priority = 0;
+            arch.CurrentCpu.CurrentScheduler.Reschedule(t_sweep);
+
+            /* Helpers for the mark and sweep phases, one per cpu */
+            gc.gengc.StartMarkWorkers();
             Formatter.WriteLine("done", arch.DebugOutput);
 
 
@@ -391,6 +411,11 @@ namespace tysos
             arch.CurrentCpu.CurrentScheduler.Reschedule(kernel_idle.startup_thread);
             kernel_idle.started = true;
 
+            Thread t_zero = Thread.Create("pmem_zero", new System.Threading.ThreadStart(arch.PhysMem.ZeroPageThreadProc),
+                new object[] { });
+            t_zero.priority = 0;
+            arch.CurrentCpu.CurrentScheduler.Reschedule(t_zero);
+
             /*Process kernel_gc = Process.Create("kernel_gc", stab.GetAddress("_ZN5tysos10tysos#2Egc2gc_16CollectionThread_Rv_P0"), 0x10000, arch.VirtualRegions, stab, new object[] { });
             kernel_gc.startup_thread.priority = 10;
             arch.CurrentCpu.CurrentScheduler.Reschedule(kernel_gc.startup_thread);
@@ -885,4 +910,4 @@ namespace tysos
             libsupcs.OtherOperations.ExitUninterruptibleSection(state);
         }
     }
-}
\ No newline at end of file
+}
\ No newline at end of file
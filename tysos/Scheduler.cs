@@ -19,6 +19,55 @@
  * THE SOFTWARE.
  */
 
+
+/* Each cpu owns its own Scheduler instance (Cpu.CurrentScheduler) with its own
+ * set of priority queues, protected by its own lock.  Threads are normally only
+ * manipulated by the scheduler of the cpu they are queued on (Thread.scheduler).
+ * 
+ * Work is spread across cpus in two ways:
+ * 
+ *  - when a cpu has nothing runnable it attempts to steal a thread from the
+ *      run queues of one of its neighbours
+ *  - every BALANCE_INTERVAL ns each cpu compares its load with the busiest
+ *      other cpu and pulls across half of the difference
+ *      
+ * We never hold two scheduler locks at the same time: a thread being migrated is
+ *  first released by its current owner (under the owner's lock) and then queued
+ *  by the new owner (under its own lock).
+ *  
+ * Blocked threads register themselves in the wait queues of the events they are
+ *  blocking on (location LOC_WAITING) and are woken by Event.Set() through
+ *  Scheduler.Wake(), so they cost nothing until signalled.  Only events which
+ *  cannot signal a change of state (e.g. DelegateEvent) are still polled, by
+ *  keeping their threads on blocking_tasks (location LOC_BLOCKING).
+ *  
+ * The run queues are linked directly through the Thread objects and a bitmap
+ *  records which priorities have runnable threads, so that enqueue, dequeue and
+ *  choosing the next thread are all constant time.
+ *  
+ * Sleeping threads, along with any other timeouts armed on this cpu, are kept
+ *  in a TimerWheel which is advanced on each timer tick.
+ *  
+ * In NO_HZ mode (the "nohz" command line option) the cpu timer is used in
+ *  one-shot mode instead of firing periodically.  After each scheduling
+ *  decision it is programmed for the earliest of the next timer wheel deadline,
+ *  the end of the current time slice (only if another thread of the same
+ *  priority is waiting for it) and the next poll of blocking_tasks.  If none of
+ *  these apply the tick is stopped completely until something wakes the cpu.
+ *  Making a thread runnable which should pre-empt or share time with the
+ *  current one brings the next tick forward.
+ *  
+ * Above all the fixed priorities is an optional earliest deadline first class.
+ *  A deadline thread reserves dl_runtime ns of cpu time in every dl_period ns,
+ *  to be delivered within dl_deadline ns of the start of each period, and is
+ *  bound to the cpu which admitted it.  Admission control keeps the total
+ *  reserved bandwidth below DL_BW_LIMIT so that ordinary threads always get a
+ *  share of the cpu.  Each deadline thread is run as a constant bandwidth
+ *  server: once it has used its runtime it is throttled until its next period,
+ *  and on waking it keeps its current deadline only if it can do so without
+ *  exceeding its reserved bandwidth.
+ */
+
 using System;
 using System.Collections.Generic;
 using System.Text;
@@ -27,24 +76,61 @@ namespace tysos
 {
     public class Scheduler
     {
-        internal tysos.Collections.Queue<Thread>[] running_tasks;
-        internal tysos.Collections.DeltaQueue<Thread> sleeping_tasks;
-        internal tysos.Collections.LinkedList<Thread> blocking_tasks;
+        internal RunQueue[] running_tasks;
+        uint runnable_mask = 0;         // bit n is set if running_tasks[n] is not empty
+        internal TimerWheel timers;
+        internal tysos.Collections.LinkedList<Thread> blocking_tasks;     // threads blocked on polled events
+        internal RunQueue dl_tasks;     // runnable deadline threads, earliest deadline first
 
         const int DEF_PRIORITIES = 11;
 
+        /** <summary>Interval (in ns) between attempts to balance load across cpus</summary> */
+        internal const long BALANCE_INTERVAL = 100000000;   // 100 ms
+
         protected int priorities;
 
+        /** <summary>The cpu this scheduler runs on</summary> */
+        internal Cpu cpu = null;
+
+        /** <summary>The number of threads in running_tasks</summary> */
+        internal int runnable_count = 0;
+
+        long balance_countdown = BALANCE_INTERVAL;
+
+        /** <summary>Use the timer in one-shot mode and only tick when there is work to do</summary> */
+        internal static bool NoHz = false;
+
+        /** <summary>Minimum delay (in ns) we program the one-shot timer with</summary> */
+        internal const long MIN_TICK = 50000;       // 50 us
+
+        /** <summary>Interval (in ns) at which to poll threads blocked on events which cannot notify us</summary> */
+        internal const long POLL_INTERVAL = 10000000;   // 10 ms
+
+        bool in_tick = false;
+
+        /** <summary>Fixed point shift used for deadline thread bandwidths</summary> */
+        internal const int DL_BW_SHIFT = 20;
+
+        /** <summary>The maximum total bandwidth which may be reserved by deadline threads on a
+         * cpu (95%)</summary> */
+        internal const long DL_BW_LIMIT = (95L << DL_BW_SHIFT) / 100;
+
+        long dl_bandwidth = 0;          // total bandwidth reserved by our deadline threads
+
         public Scheduler() : this(DEF_PRIORITIES) { }
         public Scheduler(int _priorities)
         {
+            if (_priorities > 32)
+                throw new ArgumentOutOfRangeException("_priorities", "at most 32 priorities are supported");
             priorities = _priorities;
-            running_tasks = new Collections.Queue<Thread>[priorities];
+            running_tasks = new RunQueue[priorities];
             for (int i = 0; i < priorities; i++)
-                running_tasks[i] = new Collections.Queue<Thread>();
+                running_tasks[i] = new RunQueue();
 
-            sleeping_tasks = new Collections.DeltaQueue<Thread>();
+            timers = new TimerWheel();
+            timers.scheduler = this;
             blocking_tasks = new Collections.LinkedList<Thread>();
+            dl_tasks = new RunQueue();
         }
 
         /** <summary>Reschedule a thread to the end the priority queue associated with it</summary> */
@@ -52,26 +138,166 @@ namespace tysos
         {
             _Release(thread);
 
-            thread.location = thread.priority;
-            thread.time_to_run = thread.default_slice;
+            if (thread.dl_period != 0)
+            {
+                _RescheduleDeadline(thread);
+                return;
+            }
+
+            /* In NO_HZ mode make sure we tick soon if the thread should pre-empt, or share
+             * time with, whatever is running now */
+            if (NoHz && !in_tick && thread.EffectivePriority >= util.HighestSetBit(runnable_mask))
+                _Kick(MIN_TICK);
+
+            thread.scheduler = this;
+            thread.location = thread.EffectivePriority;
+            thread.time_to_run = (thread.donated_slice > thread.default_slice) ? thread.donated_slice : thread.default_slice;
             lock (thread.BlockingOn)
             {
                 thread.BlockingOn.Clear();
             }
-            running_tasks[thread.priority].Add(thread);
+            running_tasks[thread.location].Add(thread);
+            runnable_mask |= 1U << thread.location;
+            runnable_count++;
         }
 
         /** <summary>Remove a thread from the scheduler</summary> */
         protected void _Release(Thread thread)
         {
-            if (thread.location >= 0)
-                running_tasks[thread.location].Remove(thread);
-            else if (thread.location == Thread.LOC_SLEEPING)
-                sleeping_tasks.Remove(thread);
-            else if (thread.location == Thread.LOC_BLOCKING)
-                blocking_tasks.Remove(thread);
+            if (thread.scheduler == this)
+            {
+                if (thread.location >= 0)
+                {
+                    RunQueue q = running_tasks[thread.location];
+                    q.Remove(thread);
+                    if (q.Count == 0)
+                        runnable_mask &= ~(1U << thread.location);
+                    runnable_count--;
+                }
+                else if (thread.location == Thread.LOC_SLEEPING)
+                    timers.Cancel(thread.sleep_timeout);
+                else if (thread.location == Thread.LOC_BLOCKING)
+                {
+                    blocking_tasks.Remove(thread);
+                    _RemoveWaiter(thread);
+                }
+                else if (thread.location == Thread.LOC_WAITING)
+                    _RemoveWaiter(thread);
+                else if (thread.location == Thread.LOC_DEADLINE)
+                    dl_tasks.Remove(thread);
+                else if (thread.location == Thread.LOC_THROTTLED)
+                    timers.Cancel(thread.dl_timeout);
+            }
 
             thread.location = Thread.LOC_RELEASED;
+            thread.scheduler = null;
+        }
+
+        /** <summary>Queue a deadline thread in order of its absolute deadline</summary> */
+        void _RescheduleDeadline(Thread thread)
+        {
+            long now = timers.Now;
+
+            /* Keep the current deadline only if the remaining runtime can be used before it
+             * without exceeding the reserved bandwidth, otherwise start a new period */
+            if (thread.dl_abs_deadline <= now ||
+                thread.dl_remaining * thread.dl_period > (thread.dl_abs_deadline - now) * thread.dl_runtime)
+            {
+                thread.dl_abs_deadline = now + thread.dl_deadline;
+                thread.dl_remaining = thread.dl_runtime;
+            }
+
+            thread.scheduler = this;
+            thread.location = Thread.LOC_DEADLINE;
+            lock (thread.BlockingOn)
+            {
+                thread.BlockingOn.Clear();
+            }
+
+            Thread next = dl_tasks.First;
+            while (next != null && next.dl_abs_deadline <= thread.dl_abs_deadline)
+                next = next.rq_next;
+            dl_tasks.InsertBefore(thread, next);
+
+            if (NoHz && !in_tick && dl_tasks.First == thread)
+                _Kick(MIN_TICK);
+        }
+
+        /** <summary>Called when a deadline thread has used up its runtime.  Moves it on to its next
+         * period, throttling it until that period starts</summary> */
+        void _DeadlineExhausted(Thread thread)
+        {
+            /* Any overrun is carried forward into the following periods */
+            while (thread.dl_remaining <= 0)
+            {
+                thread.dl_abs_deadline += thread.dl_period;
+                thread.dl_remaining += thread.dl_runtime;
+            }
+
+            long start = thread.dl_abs_deadline - thread.dl_deadline;
+            long now = timers.Now;
+            if (start > now)
+            {
+                _Release(thread);
+                thread.scheduler = this;
+                thread.location = Thread.LOC_THROTTLED;
+                if (thread.dl_timeout == null)
+                    thread.dl_timeout = new TimerWheel.Timeout(DeadlineReplenish, thread);
+                timers.Add(thread.dl_timeout, start - now);
+            }
+            else
+                _Reschedule(thread);
+        }
+
+        static void DeadlineReplenish(object o)
+        {
+            Thread thread = o as Thread;
+            Scheduler s = thread.scheduler;
+            if (s != null)
+                s.Unthrottle(thread);
+        }
+
+        void Unthrottle(Thread thread)
+        {
+            lock (this)
+            {
+                if (thread.scheduler == this && thread.location == Thread.LOC_THROTTLED &&
+                    !thread.dl_timeout.Pending)
+                    _Reschedule(thread);
+            }
+        }
+
+        /** <summary>Remove a thread from the wait queues of the events it is blocked on</summary> */
+        void _RemoveWaiter(Thread thread)
+        {
+            lock (thread.BlockingOn)
+            {
+                foreach (Event e in thread.BlockingOn)
+                    e.RemoveWaiter(thread);
+            }
+        }
+
+        /** <summary>Are all the events a thread is blocked on set?</summary> */
+        static bool _CanContinue(Thread thread)
+        {
+            lock (thread.BlockingOn)
+            {
+                foreach (Event e in thread.BlockingOn)
+                {
+                    if (!e.IsSet)
+                        return false;
+                }
+            }
+            return true;
+        }
+
+        /** <summary>Remove a thread from the queues of whichever other scheduler currently owns it.
+         * Must be called without holding our own lock.</summary> */
+        void _Claim(Thread thread)
+        {
+            Scheduler owner = thread.scheduler;
+            if (owner != null && owner != this)
+                owner.Deschedule(thread);
         }
 
         /** <summary>Return the next thread to run after a certain delay has elapsed</summary> */
@@ -79,7 +305,17 @@ namespace tysos
         {
             Thread ret = GetNextThread();
 
-            if (ret != null)
+            if (ret != null && ret.location == Thread.LOC_DEADLINE)
+            {
+                /* Deadline threads run until they block or use up their runtime */
+                ret.dl_remaining -= ns;
+                if (ret.dl_remaining <= 0)
+                {
+                    _DeadlineExhausted(ret);
+                    ret = GetNextThread();
+                }
+            }
+            else if (ret != null)
             {
                 if (ret.time_to_run <= ns)
                     _Reschedule(ret);
@@ -90,23 +326,144 @@ namespace tysos
             return ret;
         }
 
-        /** <summary>Return the next thread to run</summary> */
+        /** <summary>Return the next thread to run.  The caller must hold the scheduler lock.</summary> */
         internal Thread GetNextThread()
         {
             _WakeUpBlockingTasks();
 
-            int i;
-            for (i = priorities - 1; i >= 0; i--)
+            if (dl_tasks.First != null)
+                return dl_tasks.First;
+
+            if (runnable_mask == 0)
+                return null;
+
+            return running_tasks[util.HighestSetBit(runnable_mask)].First;
+        }
+
+        /** <summary>Return the next thread to run, stealing one from another cpu if we have
+         * nothing runnable ourselves</summary> */
+        public Thread PickNextThread()
+        {
+            Thread next;
+            lock (this)
+            {
+                next = GetNextThread();
+            }
+
+            if (next == null && Steal(1) > 0)
+            {
+                lock (this)
+                {
+                    next = GetNextThread();
+                }
+            }
+
+            if (NoHz)
+                _ProgramTick();
+
+            return next;
+        }
+
+        /** <summary>Return target if we can switch to it directly, i.e. it is runnable on this
+         * cpu at a priority no lower than anything else which is runnable, otherwise pick the
+         * next thread as usual.  Used to hand the cpu straight from a client to a server (and
+         * back) on a synchronous RPC without waiting for the thread to reach the front of its
+         * queue</summary> */
+        public Thread PickNextThread(Thread target)
+        {
+            if (target == null)
+                return PickNextThread();
+
+            bool handoff = false;
+            lock (this)
             {
-                Thread ret;
+                if (target.scheduler == this && target.location >= 0 && dl_tasks.First == null &&
+                    target.location >= util.HighestSetBit(runnable_mask))
+                {
+                    running_tasks[target.location].MoveToFront(target);
+                    handoff = true;
+                }
+            }
+
+            if (!handoff)
+                return PickNextThread();
 
-                ret = running_tasks[i].GetFirst(false);
+            if (NoHz)
+                _ProgramTick();
+            return target;
+        }
 
-                if (ret != null)
-                    return ret;
+        /** <summary>Bring the next tick forward to at most ns from now</summary> */
+        void _Kick(long ns)
+        {
+            /* We can only program our own timer, so interrupt any other cpu straight away */
+            Cpu cur_cpu = Program.arch.CurrentCpu;
+            if (cur_cpu != cpu)
+            {
+                if (cpu != null)
+                    cpu.Kick();
+                return;
             }
+            if (cur_cpu.CurrentTimer == null)
+                return;
 
-            return null;
+            long remaining = cur_cpu.CurrentTimer.OneShotRemaining;
+            if (remaining < 0 || remaining > ns)
+                cur_cpu.CurrentTimer.SetOneShot(ns);
+        }
+
+        /** <summary>Called by our TimerWheel when a timeout is armed</summary> */
+        internal void TimeoutAdded(long ns)
+        {
+            if (NoHz && !in_tick)
+            {
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+                _Kick(ns < MIN_TICK ? MIN_TICK : ns);
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            }
+        }
+
+        /** <summary>Program the one-shot timer for the next time we need to make a scheduling
+         * decision, or stop it if there is none</summary> */
+        void _ProgramTick()
+        {
+            Cpu cur_cpu = Program.arch.CurrentCpu;
+            if (cur_cpu != cpu || cur_cpu.CurrentTimer == null)
+                return;
+
+            long next = -1;
+            lock (this)
+            {
+                /* Time slicing is only needed if another thread is waiting at the same priority */
+                if (runnable_mask != 0)
+                {
+                    RunQueue q = running_tasks[util.HighestSetBit(runnable_mask)];
+                    if (q.Count > 1)
+                    {
+                        next = q.First.time_to_run;
+
+                        /* Only a busy cpu bothers to balance its load */
+                        if (Program.arch.Processors != null && Program.arch.Processors.Count > 1 &&
+                            balance_countdown < next)
+                            next = balance_countdown;
+                    }
+                }
+
+                /* A running deadline thread needs to be stopped when its runtime is used up */
+                if (dl_tasks.First != null && (next < 0 || dl_tasks.First.dl_remaining < next))
+                    next = dl_tasks.First.dl_remaining;
+
+                if (blocking_tasks.Count > 0 && (next < 0 || POLL_INTERVAL < next))
+                    next = POLL_INTERVAL;
+            }
+
+            long timeout = timers.NextExpiry();
+            if (timeout >= 0 && (next < 0 || timeout < next))
+                next = timeout;
+
+            if (next >= 0 && next < MIN_TICK)
+                next = MIN_TICK;
+            cur_cpu.CurrentTimer.SetOneShot(next);
         }
 
         private void _WakeUpBlockingTasks()
@@ -117,21 +474,7 @@ namespace tysos
             {
                 while (i < blocking_tasks.Count)
                 {
-                    bool can_continue = true;
-
-                    lock (blocking_tasks[i].BlockingOn)
-                    {
-                        foreach (Event e in blocking_tasks[i].BlockingOn)
-                        {
-                            if (!e.IsSet)
-                            {
-                                can_continue = false;
-                                break;
-                            }
-                        }
-                    }
-
-                    if (can_continue)
+                    if (_CanContinue(blocking_tasks[i]))
                     {
                         //blocking_tasks[i].BlockingOn.Clear();
                         System.Diagnostics.Debugger.Log(0, "Scheduler", "Waking up " + blocking_tasks[i].name);
@@ -145,9 +488,125 @@ namespace tysos
             }
         }
 
+        /** <summary>Remove a thread which is suitable for migration to the thief's cpu from our
+         * run queues</summary> */
+        Thread _GiveUpThread(Scheduler thief)
+        {
+            lock (this)
+            {
+                Thread cur = (cpu == null) ? null : cpu.CurrentThread;
+
+                for (int i = priorities - 1; i >= 0; i--)
+                {
+                    /* The head of each queue is either running or is about to be chosen to
+                     * run, so we only ever take from the tail of a queue with at least two
+                     * entries */
+                    if (running_tasks[i].Count < 2)
+                        continue;
+
+                    Thread t = running_tasks[i].Last;
+                    if (t == cur)
+                        continue;
+                    if (t.affinity != null && t.affinity != thief.cpu)
+                        continue;
+
+                    _Release(t);
+
+                    /* Mark the thread as in transit to the thief */
+                    t.scheduler = thief;
+                    return t;
+                }
+            }
+
+            return null;
+        }
+
+        /** <summary>Move up to max threads from the victim's run queues to ours</summary> */
+        int StealFrom(Scheduler victim, int max)
+        {
+            int stolen = 0;
+
+            while (stolen < max)
+            {
+                Thread t = victim._GiveUpThread(this);
+                if (t == null)
+                    break;
+
+                lock (this)
+                {
+                    /* Only queue the thread if nobody else has claimed it whilst it was
+                     * between schedulers */
+                    if (t.scheduler == this && t.location == Thread.LOC_RELEASED)
+                        _Reschedule(t);
+                }
+
+                stolen++;
+            }
+
+            return stolen;
+        }
+
+        /** <summary>Steal up to max threads from other cpus, trying the most heavily loaded first</summary> */
+        int Steal(int max)
+        {
+            int stolen = 0;
+            Scheduler victim;
+
+            while (stolen < max && (victim = GetBusiest(1)) != null)
+            {
+                int ret = StealFrom(victim, max - stolen);
+                if (ret == 0)
+                    break;
+                stolen += ret;
+            }
+
+            return stolen;
+        }
+
+        /** <summary>Pull across half the load difference between us and the busiest other cpu</summary> */
+        void Balance()
+        {
+            Scheduler busiest = GetBusiest(runnable_count + 1);
+            if (busiest == null)
+                return;
+
+            int imbalance = (busiest.runnable_count - runnable_count) / 2;
+            if (imbalance > 0)
+                StealFrom(busiest, imbalance);
+        }
+
+        /** <summary>Return the scheduler of another cpu with the most runnable threads, provided it has
+         * more than min_count of them</summary> */
+        Scheduler GetBusiest(int min_count)
+        {
+            List<Cpu> cpus = Program.arch.Processors;
+            if (cpus == null)
+                return null;
+
+            Scheduler ret = null;
+            int ret_count = min_count;
+            for (int i = 0; i < cpus.Count; i++)
+            {
+                Scheduler s = cpus[i].CurrentScheduler;
+                if (s == null || s == this)
+                    continue;
+
+                /* Unlocked read - this is only a hint */
+                int count = s.runnable_count;
+                if (count > ret_count)
+                {
+                    ret = s;
+                    ret_count = count;
+                }
+            }
+
+            return ret;
+        }
+
         // public members
         public void Deschedule(Thread thread)
         {
+            _Claim(thread);
             lock (this)
             {
                 _Release(thread);
@@ -156,6 +615,15 @@ namespace tysos
 
         public void Reschedule(Thread thread)
         {
+            /* Threads bound to a particular cpu must be queued there */
+            if (thread.affinity != null && thread.affinity.CurrentScheduler != null &&
+                thread.affinity.CurrentScheduler != this)
+            {
+                thread.affinity.CurrentScheduler.Reschedule(thread);
+                return;
+            }
+
+            _Claim(thread);
             lock (this)
             {
                 _Reschedule(thread);
@@ -164,48 +632,245 @@ namespace tysos
 
         public void Block(Thread thread)
         {
+            Event e;
+            if (thread.owning_process != null && thread.owning_process.msg_event != null)
+                e = thread.owning_process.msg_event;
+            else
+            {
+                /* No process to receive messages for - fall back to polling */
+                e = new Event();
+                e.name = "BlockOnMessage";
+                e.Type = Event.EventType.BlockOnMessage;
+                e.BlockingThread = thread;
+            }
+
+            Block(thread, e);
+        }
+
+        public void Block(Thread thread, Event ev)
+        {
+            _Claim(thread);
             lock (this)
             {
                 _Release(thread);
 
-                thread.location = Thread.LOC_BLOCKING;
+                thread.scheduler = this;
                 lock (thread.BlockingOn)
                 {
                     thread.BlockingOn.Clear();
-                    Event e = new Event();
-                    e.name = "BlockOnMessage";
-                    e.Type = Event.EventType.BlockOnMessage;
-                    e.BlockingThread = thread;
-                    thread.BlockingOn.Add(e);
+                    thread.BlockingOn.Add(ev);
+                }
+
+                if (ev.AddWaiter(thread))
+                {
+                    thread.location = Thread.LOC_WAITING;
+
+                    /* The event may have been set before we were added to its wait queue */
+                    if (ev.IsSet)
+                        _Reschedule(thread);
+                }
+                else
+                {
+                    thread.location = Thread.LOC_BLOCKING;
+                    blocking_tasks.Add(thread);
                 }
-                blocking_tasks.Add(thread);
             }
         }
 
-        public void Block(Thread thread, Event ev)
+        /** <summary>Called by an event when it changes state, to wake a thread waiting on it</summary> */
+        internal static void Wake(Thread thread)
+        {
+            Scheduler s = thread.scheduler;
+            if (s != null)
+                s.WakeUp(thread);
+        }
+
+        void WakeUp(Thread thread)
         {
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
             lock (this)
             {
-                _Release(thread);
+                /* Ignore the thread if it has since been woken, or moved elsewhere */
+                if (thread.scheduler == this && thread.location == Thread.LOC_WAITING)
+                {
+                    if (_CanContinue(thread))
+                        _Reschedule(thread);
+                    else
+                    {
+                        /* Spurious wake-up - wait again on everything */
+                        lock (thread.BlockingOn)
+                        {
+                            foreach (Event e in thread.BlockingOn)
+                                e.AddWaiter(thread);
+                        }
+                    }
+                }
+            }
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+        }
 
-                thread.location = Thread.LOC_BLOCKING;
-                lock (thread.BlockingOn)
+        /** <summary>Lend the priority and remaining time slice of one thread to another, e.g.
+         * whilst a server handles a request on behalf of a client.  Returns the priority lent,
+         * which must later be passed to ReturnPriority, or -1 if nothing was lent</summary> */
+        public static int DonatePriority(Thread from, Thread to)
+        {
+            if (from == null || to == null || from == to)
+                return -1;
+
+            int p = from.EffectivePriority;
+            long slice = from.time_to_run;
+
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock (to)
+            {
+                if (to.donated_count == null)
+                    to.donated_count = new int[32];
+                to.donated_count[p]++;
+                to.donated_mask |= 1U << p;
+                if (slice > to.donated_slice)
+                    to.donated_slice = slice;
+            }
+
+            Scheduler s = to.scheduler;
+            if (s != null)
+                s.UpdatePriority(to);
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+
+            return p;
+        }
+
+        /** <summary>Return a priority previously lent with DonatePriority</summary> */
+        public static void ReturnPriority(Thread to, int p)
+        {
+            if (to == null || p < 0)
+                return;
+
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock (to)
+            {
+                if (to.donated_count != null && to.donated_count[p] > 0)
                 {
-                    thread.BlockingOn.Clear();
-                    thread.BlockingOn.Add(ev);
+                    to.donated_count[p]--;
+                    if (to.donated_count[p] == 0)
+                    {
+                        to.donated_mask &= ~(1U << p);
+                        if (to.donated_mask == 0)
+                            to.donated_slice = 0;
+                    }
+                }
+            }
+
+            Scheduler s = to.scheduler;
+            if (s != null)
+                s.UpdatePriority(to);
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+        }
+
+        /** <summary>Move a runnable thread to the queue for its current effective priority.
+         * Threads which are not runnable pick it up when they are next woken</summary> */
+        void UpdatePriority(Thread thread)
+        {
+            lock (this)
+            {
+                if (thread.scheduler == this && thread.location >= 0 &&
+                    thread.location != thread.EffectivePriority)
+                    _Reschedule(thread);
+            }
+        }
+
+        /** <summary>Make a thread a deadline thread which is guaranteed runtime ns of cpu time in
+         * every period ns, within deadline ns of the start of each period.  The thread is bound
+         * to this cpu whilst it is a deadline thread.  A runtime of zero returns it to fixed
+         * priority scheduling and restores its previous affinity.  Returns false if the parameters
+         * are invalid, the thread is bound to another cpu or this one does not have enough spare
+         * capacity</summary> */
+        public bool SetDeadline(Thread thread, long runtime, long period, long deadline)
+        {
+            if (runtime < 0 || (runtime > 0 && (deadline < runtime || period < deadline)))
+                return false;
+            if (runtime > (long.MaxValue >> DL_BW_SHIFT))
+                return false;
+
+            long bw = (runtime == 0) ? 0 : (runtime << DL_BW_SHIFT) / period;
+
+            lock (this)
+            {
+                /* The thread must be ours, and any existing reservation must be on this cpu */
+                if (thread.scheduler != null && thread.scheduler != this)
+                    return false;
+                if (thread.affinity != null && thread.affinity != cpu)
+                    return false;
+
+                if (dl_bandwidth - thread.dl_bw + bw > DL_BW_LIMIT)
+                    return false;
+
+                bool runnable = thread.scheduler == this && (thread.location >= 0 ||
+                    thread.location == Thread.LOC_DEADLINE || thread.location == Thread.LOC_THROTTLED);
+                if (runnable)
+                    _Release(thread);
+
+                dl_bandwidth += bw - thread.dl_bw;
+                thread.dl_bw = bw;
+                thread.dl_runtime = runtime;
+                thread.dl_deadline = deadline;
+                thread.dl_abs_deadline = 0;
+                thread.dl_remaining = 0;
+                if (runtime == 0)
+                {
+                    if (thread.dl_period != 0)
+                    {
+                        thread.affinity = thread.dl_saved_affinity;
+                        thread.dl_saved_affinity = null;
+                    }
+                    thread.dl_period = 0;
                 }
-                blocking_tasks.Add(thread);
+                else
+                {
+                    if (thread.dl_period == 0)
+                        thread.dl_saved_affinity = thread.affinity;
+                    thread.dl_period = period;
+                    thread.affinity = cpu;
+                }
+
+                if (runnable)
+                    _Reschedule(thread);
             }
+
+            return true;
         }
 
         public void Sleep(Thread thread, long ns)
         {
+            _Claim(thread);
             lock (this)
             {
                 _Release(thread);
 
+                thread.scheduler = this;
                 thread.location = Thread.LOC_SLEEPING;
-                sleeping_tasks.InsertAtDelta(thread, ns);
+                if (thread.sleep_timeout == null)
+                    thread.sleep_timeout = new TimerWheel.Timeout(SleepExpired, thread);
+                timers.Add(thread.sleep_timeout, ns);
+            }
+        }
+
+        static void SleepExpired(object o)
+        {
+            Thread thread = o as Thread;
+            Scheduler s = thread.scheduler;
+            if (s != null)
+                s.WakeSleeper(thread);
+        }
+
+        void WakeSleeper(Thread thread)
+        {
+            lock (this)
+            {
+                /* Ignore the thread if it has since been woken, moved elsewhere or put
+                 * back to sleep */
+                if (thread.scheduler == this && thread.location == Thread.LOC_SLEEPING &&
+                    !thread.sleep_timeout.Pending)
+                    _Reschedule(thread);
             }
         }
 
@@ -217,6 +882,14 @@ namespace tysos
                 next = _GetNextThread(ns);
             }
 
+            if (next == null && Steal(1) > 0)
+            {
+                lock (this)
+                {
+                    next = GetNextThread();
+                }
+            }
+
             if ((next != cur) && (next != null))
             {
                 switcher.Switch(next);
@@ -228,24 +901,26 @@ namespace tysos
         public Thread TimerTick(long ns, Thread cur, TaskSwitcher switcher)
         {
             //System.Diagnostics.Debugger.Log(0, "Scheduler", "TimerTick");
-            /* first wake up any sleeping tasks */
+            /* first wake up any sleeping tasks and run expired timeouts */
             var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            in_tick = true;
 
-            lock (this)
-            {
-                sleeping_tasks.DecreaseDelta(ns);
-                Thread sleeping_thread = null;
+            timers.Advance(ns);
 
-                do
-                {
-                    sleeping_thread = sleeping_tasks.GetZero();
-                    if (sleeping_thread != null)
-                        _Reschedule(sleeping_thread);
-                } while (sleeping_thread != null);
+            /* periodically even out the load between cpus */
+            balance_countdown -= ns;
+            if (balance_countdown <= 0)
+            {
+                balance_countdown = BALANCE_INTERVAL;
+                Balance();
             }
 
             var ret = ScheduleNext(ns, cur, switcher);
 
+            in_tick = false;
+            if (NoHz)
+                _ProgramTick();
+
             libsupcs.OtherOperations.ExitUninterruptibleSection(state);
             return ret;
         }
@@ -254,5 +929,84 @@ namespace tysos
         {
             Program.arch.CurrentCpu.CurrentScheduler.TimerTick(ns, Program.arch.CurrentCpu.CurrentThread, Program.arch.Switcher);
         }
+
+        /** <summary>A FIFO of threads linked through Thread.rq_next and Thread.rq_prev</summary> */
+        internal class RunQueue
+        {
+            Thread head = null;
+            Thread tail = null;
+            int count = 0;
+
+            public int Count { get { return count; } }
+            public Thread First { get { return head; } }
+            public Thread Last { get { return tail; } }
+
+            public void Add(Thread t)
+            {
+                t.rq_next = null;
+                t.rq_prev = tail;
+                if (tail == null)
+                    head = t;
+                else
+                    tail.rq_next = t;
+                tail = t;
+                count++;
+            }
+
+            /** <summary>Remove a thread, which must be in this queue</summary> */
+            public void Remove(Thread t)
+            {
+                if (t.rq_prev != null)
+                    t.rq_prev.rq_next = t.rq_next;
+                else
+                    head = t.rq_next;
+
+                if (t.rq_next != null)
+                    t.rq_next.rq_prev = t.rq_prev;
+                else
+                    tail = t.rq_prev;
+
+                t.rq_next = null;
+                t.rq_prev = null;
+                count--;
+            }
+
+            /** <summary>Insert a thread before another one in this queue, or at the end if
+             * next is null</summary> */
+            public void InsertBefore(Thread t, Thread next)
+            {
+                if (next == null)
+                {
+                    Add(t);
+                    return;
+                }
+
+                t.rq_next = next;
+                t.rq_prev = next.rq_prev;
+                if (next.rq_prev == null)
+                    head = t;
+                else
+                    next.rq_prev.rq_next = t;
+                next.rq_prev = t;
+                count++;
+            }
+
+            /** <summary>Move a thread, which must be in this queue, to the front</summary> */
+            public void MoveToFront(Thread t)
+            {
+                if (head == t)
+                    return;
+
+                Remove(t);
+                t.rq_prev = null;
+                t.rq_next = head;
+                if (head == null)
+                    tail = t;
+                else
+                    head.rq_prev = t;
+                head = t;
+                count++;
+            }
+        }
     }
 }
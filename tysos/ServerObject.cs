@@ -48,6 +48,7 @@ namespace tysos
     {
         protected Thread t = null;
         protected Thread SourceThread = null;
+        Thread reply_to = null;     // client woken by our last reply, to switch straight back to
         public string MountPath = null;
         public List<string> Tags = new List<string>();
 
@@ -80,12 +81,37 @@ namespace tysos
                 System.Diagnostics.Debugger.Log(0, null, "RPC Sync begin waiting");
                 while (!IsSet)
                 {
-                    Syscalls.SchedulerFunctions.Block(this);
+                    // Switch straight to the server thread if it is ready to handle our request
+                    Syscalls.SchedulerFunctions.BlockAndSwitch(this, (Server == null) ? null : Server.t);
                 }
                 System.Diagnostics.Debugger.Log(0, null, "RPC Sync waiting done");
                 return Result;
             }
 
+            /** <summary>Wait at most timeout_ns nanoseconds for the result.  Returns false if the
+             * call timed out</summary> */
+            public bool Sync(long timeout_ns, out T result)
+            {
+                TimerEvent te = new TimerEvent(timeout_ns / 100);
+                WaitAnyEvent wae = new WaitAnyEvent();
+                wae.Children.Add(this);
+                wae.Children.Add(te);
+
+                while (!IsSet && !te.IsSet)
+                {
+                    Syscalls.SchedulerFunctions.Block(wae);
+                }
+                te.Cancel();
+
+                if (IsSet)
+                {
+                    result = Result;
+                    return true;
+                }
+                result = default(T);
+                return false;
+            }
+
             public void SetCallback(ObjectDelegate meth, object cb_obj)
             {
                 lock(this)
@@ -153,7 +179,15 @@ namespace tysos
                 System.Diagnostics.Debugger.Log(0, null, "RPC request remote " + libsupcs.CastOperations.ReinterpretAs<ulong>(mptr).ToString("X16") +
                     " on thread " + curso.t.name);
 
-                Syscalls.IPCFunctions.SendMessage(curso.t.owning_process, rpc);
+                // Run the server at (at least) our priority until it has handled the request
+                rpc.DonatedTo = curso.t;
+                rpc.DonatedPriority = Syscalls.SchedulerFunctions.DonatePriority(curso.t);
+
+                if (!Syscalls.IPCFunctions.SendMessage(curso.t.owning_process, rpc))
+                {
+                    Syscalls.SchedulerFunctions.ReturnPriority(rpc.DonatedTo, rpc.DonatedPriority);
+                    rpc.DonatedPriority = -1;
+                }
 
                 return libsupcs.CastOperations.ReinterpretAsPointer(rpc.result);
             }
@@ -206,7 +240,8 @@ namespace tysos
 
                 BackgroundProc();
 
-                Syscalls.SchedulerFunctions.Block();
+                Syscalls.SchedulerFunctions.BlockAndSwitch(reply_to);
+                reply_to = null;
             }
         }
 
@@ -230,7 +265,17 @@ namespace tysos
                 (libsupcs.CastOperations.ReinterpretAs<RPCResult<object>>(rpc.result)).Result = ret2.Result;
 
                 if(rpc.EventSetsOnReturn)
+                {
                     rpc.result.Set();
+                    reply_to = msg.Source;
+                }
+
+                // Only drop back to our own priority once the caller has been woken
+                if (rpc.DonatedPriority >= 0)
+                {
+                    Syscalls.SchedulerFunctions.ReturnPriority(rpc.DonatedTo, rpc.DonatedPriority);
+                    rpc.DonatedPriority = -1;
+                }
 
                 System.Diagnostics.Debugger.Log(0, null, "RPC call to " + maddr.ToString("X16") + " finished");
 
@@ -196,11 +196,7 @@ namespace tysos
                 if (cur != null)
                     sched.Reschedule(cur);
 
-                Thread next;
-                lock (sched)
-                {
-                    next = sched.GetNextThread();
-                }
+                Thread next = sched.PickNextThread();
 
                 if ((next != cur) && (next != null))
                     switcher.Switch(next);
@@ -224,11 +220,7 @@ namespace tysos
                 if (cur != null)
                     sched.Block(cur);
                 
-                Thread next;
-                lock (sched)
-                {
-                     next = sched.GetNextThread();
-                }
+                Thread next = sched.PickNextThread();
 
                 if ((next != cur) && (next != null))
                     switcher.Switch(next);
@@ -255,11 +247,81 @@ namespace tysos
                     sched.Block(cur, e);
                 }
 
-                Thread next;
-                lock (sched)
-                {
-                    next = sched.GetNextThread();
-                }
+                Thread next = sched.PickNextThread();
+
+                if ((next != cur) && (next != null))
+                    switcher.Switch(next);
+
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            }
+
+            [libsupcs.Syscall]
+            public static void BlockAndSwitch(Event e, Thread target)
+            {
+                /* Block on an event, passing the cpu straight to target if it is runnable
+                 * here.  This is the fast path for synchronous RPC. */
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+                Thread cur = Program.arch.CurrentCpu.CurrentThread;
+                Scheduler sched = Program.arch.CurrentCpu.CurrentScheduler;
+                TaskSwitcher switcher = Program.arch.Switcher;
+
+                if (sched == null)
+                    throw new Exception("Cannot block as scheduler not yet initialized");
+
+                if (cur != null)
+                    sched.Block(cur, e);
+
+                Thread next = sched.PickNextThread(target);
+
+                if ((next != cur) && (next != null))
+                    switcher.Switch(next);
+
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            }
+
+            [libsupcs.Syscall]
+            public static void BlockAndSwitch(Thread target)
+            {
+                /* Block pending receipt of a message, passing the cpu straight to target if
+                 * it is runnable here (e.g. a client we have just replied to) */
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+                Thread cur = Program.arch.CurrentCpu.CurrentThread;
+                Scheduler sched = Program.arch.CurrentCpu.CurrentScheduler;
+                TaskSwitcher switcher = Program.arch.Switcher;
+
+                if (sched == null)
+                    throw new Exception("Cannot block as scheduler not yet initialized");
+
+                if (cur != null)
+                    sched.Block(cur);
+
+                Thread next = sched.PickNextThread(target);
+
+                if ((next != cur) && (next != null))
+                    switcher.Switch(next);
+
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            }
+
+            [libsupcs.Syscall]
+            public static void Sleep(long ns)
+            {
+                /* Sleep for at least ns nanoseconds */
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+                Thread cur = Program.arch.CurrentCpu.CurrentThread;
+                Scheduler sched = Program.arch.CurrentCpu.CurrentScheduler;
+                TaskSwitcher switcher = Program.arch.Switcher;
+
+                if (sched == null)
+                    throw new Exception("Cannot sleep as scheduler not yet initialized");
+
+                if (cur != null)
+                    sched.Sleep(cur, ns);
+
+                Thread next = sched.PickNextThread();
 
                 if ((next != cur) && (next != null))
                     switcher.Switch(next);
@@ -267,6 +329,63 @@ namespace tysos
                 libsupcs.OtherOperations.ExitUninterruptibleSection(state);
             }
 
+            [libsupcs.Syscall]
+            public static void SetTimeout(TimerWheel.Timeout t, long ns)
+            {
+                /* Arm a timeout on the timer wheel of the current cpu */
+                Scheduler sched = Program.arch.CurrentCpu.CurrentScheduler;
+                if (sched == null)
+                    throw new Exception("Cannot set timeout as scheduler not yet initialized");
+                sched.timers.Add(t, ns);
+            }
+
+            [libsupcs.Syscall]
+            public static bool CancelTimeout(TimerWheel.Timeout t)
+            {
+                TimerWheel w = t.wheel;
+                if (w == null)
+                    return false;
+                return w.Cancel(t);
+            }
+
+            [libsupcs.Syscall]
+            public static bool SetDeadline(long runtime, long period, long deadline)
+            {
+                /* Reserve runtime ns in every period ns for the current thread, delivered
+                 * within deadline ns of the start of each period */
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+                Thread cur = Program.arch.CurrentCpu.CurrentThread;
+                Scheduler sched = Program.arch.CurrentCpu.CurrentScheduler;
+
+                if (sched == null)
+                    throw new Exception("Cannot set deadline as scheduler not yet initialized");
+
+                bool ret = (cur != null) && sched.SetDeadline(cur, runtime, period, deadline);
+
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                return ret;
+            }
+
+            [libsupcs.Syscall]
+            public static void ClearDeadline()
+            {
+                SetDeadline(0, 0, 0);
+            }
+
+            [libsupcs.Syscall]
+            public static int DonatePriority(Thread to)
+            {
+                /* Lend our priority to another thread whilst it works on our behalf */
+                return Scheduler.DonatePriority(Program.arch.CurrentCpu.CurrentThread, to);
+            }
+
+            [libsupcs.Syscall]
+            public static void ReturnPriority(Thread to, int priority)
+            {
+                Scheduler.ReturnPriority(to, priority);
+            }
+
             [libsupcs.Syscall]
             public static Thread GetCurrentThread()
             {
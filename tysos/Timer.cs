@@ -45,5 +45,19 @@ namespace tysos
 
         /** <summary>Return the current timer ticks in 100 ns intervals</summary> */
         abstract internal long Ticks { get; }
+
+        /** <summary>Can the timer be programmed to fire once after an arbitrary delay?</summary> */
+        virtual internal bool SupportsOneShot { get { return false; } }
+
+        /** <summary>Switch the timer to one-shot mode and fire the callback once after ns
+         * nanoseconds.  The interval passed to the callback is the time elapsed since the last
+         * callback.  A negative value stops the timer.</summary> */
+        virtual internal void SetOneShot(long ns)
+        {
+            throw new NotSupportedException();
+        }
+
+        /** <summary>Time (in ns) until the one-shot timer fires, or -1 if it is not armed</summary> */
+        virtual internal long OneShotRemaining { get { return -1; } }
     }
 }
@@ -0,0 +1,340 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* A hierarchical timing wheel, as described by Varghese and Lauck.
+ * 
+ * Time is divided into ticks of RESOLUTION ns.  There are LEVELS wheels of
+ *  LEVEL_SIZE slots each: a timeout which expires within LEVEL_SIZE ticks is
+ *  placed in the slot of the first wheel for its exact tick, one which expires
+ *  within LEVEL_SIZE^2 ticks in the slot of the second wheel covering the
+ *  LEVEL_SIZE ticks around its expiry, and so on.  Every LEVEL_SIZE ticks the
+ *  next slot of the wheel above is emptied and its timeouts re-inserted
+ *  (cascaded) into the wheels below.
+ *  
+ * Each slot is an intrusive doubly linked list through the Timeout objects
+ *  themselves, so adding and cancelling a timeout are constant time and no
+ *  memory is allocated by the wheel itself.  The cost of a tick is independent
+ *  of the number of outstanding timeouts.
+ *  
+ * Each Scheduler owns a TimerWheel, advanced from its TimerTick.  Callbacks
+ *  are run with interrupts disabled but without the wheel lock held, so they
+ *  may re-arm their timeout or take the scheduler lock.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Text;
+
+namespace tysos
+{
+    public class TimerWheel
+    {
+        /** <summary>Length of a tick of the wheel, in ns</summary> */
+        public const long RESOLUTION = 1000000;     // 1 ms
+
+        const int LEVEL_BITS = 6;
+        const int LEVEL_SIZE = 1 << LEVEL_BITS;
+        const int LEVEL_MASK = LEVEL_SIZE - 1;
+        const int LEVELS = 4;
+
+        /** <summary>The furthest ahead (in ticks) a timeout can be placed in the wheel.  Timeouts
+         * beyond this are parked in the last slot and re-inserted when it comes round</summary> */
+        const long MAX_DELTA = (1L << (LEVEL_BITS * LEVELS)) - 1;
+
+        public delegate void TimeoutCallback(object o);
+
+        /** <summary>A single pending callback.  The same object may be re-armed as often as
+         * required once it has fired or been cancelled</summary> */
+        public class Timeout
+        {
+            internal long expires;          // tick at which to fire
+            internal Timeout next, prev;    // links within a slot
+            internal Timeout fire_next;     // link within the list of expired timeouts
+            internal TimerWheel wheel;      // wheel this is queued on, or null if not pending
+            internal int slot;
+
+            TimeoutCallback callback;
+            object obj;
+
+            public Timeout(TimeoutCallback cb, object o)
+            {
+                callback = cb;
+                obj = o;
+            }
+
+            /** <summary>Is this timeout queued on a wheel?</summary> */
+            public bool Pending { get { return wheel != null; } }
+
+            /** <summary>Cancel this timeout if it is pending</summary> */
+            public void Cancel()
+            {
+                TimerWheel w = wheel;
+                if (w != null)
+                    w.Cancel(this);
+            }
+
+            internal void Fire()
+            {
+                if (callback != null)
+                    callback(obj);
+            }
+        }
+
+        Timeout[] slots = new Timeout[LEVELS * LEVEL_SIZE];
+        long cur_tick = 0;      // the next tick to be processed
+        long now = 0;           // ns since the wheel was created
+        int count = 0;
+
+        /** <summary>The scheduler which owns this wheel, if any.  It is told about new timeouts
+         * so that it can make sure it ticks in time for them</summary> */
+        internal Scheduler scheduler = null;
+
+        /** <summary>The number of pending timeouts</summary> */
+        public int Count { get { return count; } }
+
+        /** <summary>Time (in ns) since the wheel was created</summary> */
+        public long Now { get { return now; } }
+
+        /** <summary>Arm a timeout to fire after ns nanoseconds.  If it is already pending it is
+         * moved to the new expiry time</summary> */
+        public void Add(Timeout t, long ns)
+        {
+            if (ns < 0)
+                ns = 0;
+
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock (this)
+            {
+                if (t.wheel != null)
+                    t.wheel._Unlink(t);
+
+                long expires = (now + ns + RESOLUTION - 1) / RESOLUTION;
+                if (expires < cur_tick)
+                    expires = cur_tick;
+                t.expires = expires;
+                t.wheel = this;
+                _Insert(t);
+                count++;
+            }
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+
+            if (scheduler != null)
+                scheduler.TimeoutAdded(ns);
+        }
+
+        /** <summary>Cancel a pending timeout.  Returns false if it was not pending (e.g. it has
+         * already fired)</summary> */
+        public bool Cancel(Timeout t)
+        {
+            bool ret = false;
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock (this)
+            {
+                if (t.wheel == this)
+                {
+                    _Unlink(t);
+                    ret = true;
+                }
+            }
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return ret;
+        }
+
+        /** <summary>Place a timeout in the slot appropriate to its expiry time.  The caller must
+         * hold the wheel lock</summary> */
+        void _Insert(Timeout t)
+        {
+            long delta = t.expires - cur_tick;
+            long when = t.expires;
+
+            /* Timeouts too far in the future are parked in the furthest slot we can
+             * represent and re-examined when it is cascaded */
+            if (delta > MAX_DELTA)
+            {
+                delta = MAX_DELTA;
+                when = cur_tick + MAX_DELTA;
+            }
+
+            int level = 0;
+            while (level < LEVELS - 1 && delta >= (1L << ((level + 1) * LEVEL_BITS)))
+                level++;
+
+            int slot = level * LEVEL_SIZE + (int)((when >> (level * LEVEL_BITS)) & LEVEL_MASK);
+
+            t.slot = slot;
+            t.prev = null;
+            t.next = slots[slot];
+            if (t.next != null)
+                t.next.prev = t;
+            slots[slot] = t;
+        }
+
+        /** <summary>Remove a timeout from its slot.  The caller must hold the wheel lock</summary> */
+        void _Unlink(Timeout t)
+        {
+            if (t.prev != null)
+                t.prev.next = t.next;
+            else
+                slots[t.slot] = t.next;
+            if (t.next != null)
+                t.next.prev = t.prev;
+
+            t.next = null;
+            t.prev = null;
+            t.wheel = null;
+            count--;
+        }
+
+        /** <summary>Re-insert all the timeouts in a slot of one of the upper wheels</summary> */
+        void _Cascade(int level, int idx)
+        {
+            int slot = level * LEVEL_SIZE + idx;
+            Timeout t = slots[slot];
+            slots[slot] = null;
+
+            while (t != null)
+            {
+                Timeout next = t.next;
+                _Insert(t);
+                t = next;
+            }
+        }
+
+        /** <summary>Return the time (in ns) until the wheel next has work to do, i.e. until the
+         * earliest timeout expires or the earliest cascade of a non-empty slot, or -1 if
+         * there are no pending timeouts</summary> */
+        public long NextExpiry()
+        {
+            long ret = -1;
+
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock (this)
+            {
+                if (count != 0)
+                {
+                    long best = long.MaxValue;
+
+                    /* The first wheel is indexed directly by tick */
+                    for (long t = cur_tick; t < cur_tick + LEVEL_SIZE; t++)
+                    {
+                        if (slots[t & LEVEL_MASK] != null)
+                        {
+                            best = t;
+                            break;
+                        }
+                    }
+
+                    /* Slots of the upper wheels need attention when they are cascaded */
+                    for (int level = 1; level < LEVELS; level++)
+                    {
+                        long step = 1L << (level * LEVEL_BITS);
+                        long first = (cur_tick + step - 1) & ~(step - 1);
+                        if (first >= best)
+                            break;
+
+                        for (long t = first; t < first + LEVEL_SIZE * step && t < best; t += step)
+                        {
+                            if (slots[level * LEVEL_SIZE + (int)((t >> (level * LEVEL_BITS)) & LEVEL_MASK)] != null)
+                            {
+                                best = t;
+                                break;
+                            }
+                        }
+                    }
+
+                    if (best != long.MaxValue)
+                    {
+                        ret = best * RESOLUTION - now;
+                        if (ret < 0)
+                            ret = 0;
+                    }
+                }
+            }
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return ret;
+        }
+
+        /** <summary>Advance the wheel by ns nanoseconds and run the callbacks of all the
+         * timeouts which have expired</summary> */
+        public void Advance(long ns)
+        {
+            Timeout expired = null;
+
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock (this)
+            {
+                now += ns;
+                long target = now / RESOLUTION;
+
+                while (cur_tick <= target)
+                {
+                    if (count == 0)
+                    {
+                        /* Nothing to do - skip straight to the end */
+                        cur_tick = target + 1;
+                        break;
+                    }
+
+                    /* At the start of each revolution of a wheel, refill it from the
+                     * next slot of the wheel above */
+                    for (int level = 1; level < LEVELS; level++)
+                    {
+                        if (((cur_tick >> ((level - 1) * LEVEL_BITS)) & LEVEL_MASK) != 0)
+                            break;
+                        _Cascade(level, (int)((cur_tick >> (level * LEVEL_BITS)) & LEVEL_MASK));
+                    }
+
+                    /* Move everything in the current slot onto the expired list */
+                    int slot = (int)(cur_tick & LEVEL_MASK);
+                    Timeout t = slots[slot];
+                    slots[slot] = null;
+                    while (t != null)
+                    {
+                        Timeout next = t.next;
+                        t.wheel = null;
+                        t.next = null;
+                        t.prev = null;
+                        t.fire_next = expired;
+                        expired = t;
+                        count--;
+                        t = next;
+                    }
+
+                    cur_tick++;
+                }
+            }
+
+            /* Run the callbacks without the lock held, as they may re-arm themselves */
+            while (expired != null)
+            {
+                Timeout t = expired;
+                expired = t.fire_next;
+                t.fire_next = null;
+
+                /* The timeout may have been re-armed by an earlier callback */
+                if (t.wheel == null)
+                    t.Fire();
+            }
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+        }
+    }
+}
@@ -47,6 +47,11 @@ namespace tysos
         public const uint FLAG_write_through = 0x8;
         public const uint FLAG_cache_disable = 0x10;
 
+        /** <summary>Map the pages read-only, taking a reference on each.  The first write
+         * to a page gives the writer a private copy.  Any other mappings of the pages must
+         * be read-only or copy-on-write as well (ShareCopyOnWrite arranges this)</summary> */
+        public const uint FLAG_cow = 0x20;
+
         public struct VMapping
         {
             public nuint vaddr;
@@ -56,6 +61,24 @@ namespace tysos
         }
         public abstract VMapping Map(nuint paddr, nuint len, nuint vaddr, uint flags);
 
+        /** <summary>Remove the mapping of a single page.  Returns the physical address it was
+         * mapped to (which the caller should pass to PhysMem.ReleaseMapped, as it may be
+         * shared), or 0 if it was not mapped</summary>
+         */
+        public abstract nuint Unmap(nuint vaddr);
+
+        /** <summary>Resolve a write fault on a copy-on-write page by giving vaddr a private,
+         * writeable copy (or the page itself, if nothing else maps it any more).  Returns
+         * false if vaddr is not mapped copy-on-write</summary>
+         */
+        public abstract bool CopyOnWrite(nuint vaddr);
+
+        /** <summary>Make [dest_vaddr, dest_vaddr + len) a copy-on-write image of the pages
+         * currently mapped at src_vaddr, which become copy-on-write too.  Pages not yet
+         * mapped at the source are left unmapped at the destination</summary>
+         */
+        public abstract void ShareCopyOnWrite(nuint src_vaddr, nuint dest_vaddr, nuint len);
+
         /** <summary>Is the provided virtual address actually mapped?</summary>
          */
         public abstract bool IsValid(ulong vaddr);
@@ -228,6 +228,12 @@ namespace tysos.elf
                         s.Seek((long)cur_shdr->sh_offset, System.IO.SeekOrigin.Begin);
                         s.Read(sect_data, 0, (int)cur_shdr->sh_size);
                         System.Diagnostics.Debugger.Log(0, null, "ElfFileReader.LoadObject: end loading section data");
+
+                        /* Data sections are shared copy-on-write with any previously loaded
+                         * section with the same contents, which can only be found once it has
+                         * been read */
+                        if (gc_data && !SharedSections.TryShare(vmem, (byte*)sect_addr, sect_addr, cur_shdr->sh_size))
+                            SharedSections.AddTemplate(vreg, vmem, name, sect_name, sect_addr, cur_shdr->sh_size);
                     }
                     else if (cur_shdr->sh_type == 0x8)
                     {
@@ -326,9 +326,16 @@ namespace tysos
                     // copy the section to its destination
                     if (cur_shdr->sh_type == 0x1)
                     {
-                        /* SHT_PROGBITS */
-                        libsupcs.MemoryOperations.MemCpy((void*)sect_addr, (void*)(binary + cur_shdr->sh_offset),
-                            (int)cur_shdr->sh_size);
+                        /* SHT_PROGBITS - data sections are shared copy-on-write with any
+                         * previously loaded section with the same contents */
+                        if (!gc_data || !SharedSections.TryShare(vmem, (byte*)(binary + cur_shdr->sh_offset),
+                            sect_addr, cur_shdr->sh_size))
+                        {
+                            libsupcs.MemoryOperations.MemCpy((void*)sect_addr, (void*)(binary + cur_shdr->sh_offset),
+                                (int)cur_shdr->sh_size);
+                            if (gc_data)
+                                SharedSections.AddTemplate(vreg, vmem, name, sect_name, sect_addr, cur_shdr->sh_size);
+                        }
                     }
                     else if (cur_shdr->sh_type == 0x8)
                     {
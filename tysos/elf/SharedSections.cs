@@ -0,0 +1,195 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Copy-on-write sharing of module data sections.
+ * 
+ * When a module's writeable data section is first loaded, a template region is made a
+ *  copy-on-write image of it before relocations are applied.  Later loads of a section with
+ *  identical contents then share the template's pages instead of copying the section again,
+ *  and only the pages they write to (including those their relocations touch) get private
+ *  copies.
+ *  
+ * Templates are found by a hash of the section contents, and the contents are compared
+ *  before sharing, so unrelated modules which happen to have the same name and size never
+ *  share data.  Each template counts the sections using it, and is freed when the last of
+ *  them is passed to Release.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Text;
+
+namespace tysos.elf
+{
+    unsafe static class SharedSections
+    {
+        class Template
+        {
+            public ulong addr, len, hash;
+            public int users;
+            public Template next;       // next with the same hash
+        }
+
+        static Dictionary<ulong, Template> templates = new Dictionary<ulong, Template>(new Program.MyGenericEqualityComparer<ulong>());
+        static Dictionary<ulong, Template> users = new Dictionary<ulong, Template>(new Program.MyGenericEqualityComparer<ulong>());
+
+        /** <summary>FNV-1a hash of a section's contents, a quadword at a time</summary> */
+        static ulong hash(byte* p, ulong len)
+        {
+            ulong h = 0xcbf29ce484222325UL;
+            ulong i = 0;
+            for (; i + 8 <= len; i += 8)
+            {
+                h ^= *(ulong*)(p + i);
+                h *= 0x100000001b3UL;
+            }
+            for (; i < len; i++)
+            {
+                h ^= p[i];
+                h *= 0x100000001b3UL;
+            }
+            return h;
+        }
+
+        static bool same(byte* a, byte* b, ulong len)
+        {
+            ulong i = 0;
+            for (; i + 8 <= len; i += 8)
+            {
+                if (*(ulong*)(a + i) != *(ulong*)(b + i))
+                    return false;
+            }
+            for (; i < len; i++)
+            {
+                if (a[i] != b[i])
+                    return false;
+            }
+            return true;
+        }
+
+        /** <summary>Find the template for a section with the given contents.  Called with
+         * templates locked</summary> */
+        static Template find(byte* contents, ulong len, ulong h)
+        {
+            Template t;
+            if (!templates.TryGetValue(h, out t))
+                return null;
+            for (; t != null; t = t.next)
+            {
+                if (t.len == len && same((byte*)t.addr, contents, len))
+                    return t;
+            }
+            return null;
+        }
+
+        /** <summary>Fill the section at sect_addr from a template with the given (unrelocated)
+         * contents, if one exists.  Any pages already mapped at sect_addr are released
+         * first, so contents may be the section itself</summary> */
+        internal static bool TryShare(VirtMem vmem, byte* contents, ulong sect_addr, ulong sect_len)
+        {
+            ulong h = hash(contents, sect_len);
+            lock (templates)
+            {
+                Template t = find(contents, sect_len, h);
+                if (t == null)
+                    return false;
+
+                release_pages(vmem, sect_addr, sect_len);
+                vmem.ShareCopyOnWrite(t.addr, sect_addr, sect_len);
+                t.users++;
+                users[sect_addr] = t;
+            }
+            return true;
+        }
+
+        /** <summary>Keep an unrelocated image of a freshly loaded section for later
+         * loads of the same contents</summary> */
+        internal static void AddTemplate(Virtual_Regions vreg, VirtMem vmem, string name, string sect_name,
+            ulong sect_addr, ulong sect_len)
+        {
+            ulong h = hash((byte*)sect_addr, sect_len);
+            lock (templates)
+            {
+                if (find((byte*)sect_addr, sect_len, h) != null)
+                    return;
+
+                Template t = new Template();
+                t.addr = vreg.AllocRegion(sect_len, 0x1000, name + sect_name + "_template", 0,
+                    Virtual_Regions.Region.RegionType.ModuleSection, false).start;
+                t.len = sect_len;
+                t.hash = h;
+                t.users = 1;
+                vmem.ShareCopyOnWrite(sect_addr, t.addr, sect_len);
+
+                Template first;
+                if (templates.TryGetValue(h, out first))
+                    t.next = first;
+                templates[h] = t;
+                users[sect_addr] = t;
+            }
+        }
+
+        /** <summary>Called when the section at sect_addr is unloaded.  Frees the template it
+         * was shared with if nothing else uses it</summary> */
+        internal static void Release(VirtMem vmem, ulong sect_addr)
+        {
+            lock (templates)
+            {
+                Template t;
+                if (!users.TryGetValue(sect_addr, out t))
+                    return;
+                users.Remove(sect_addr);
+                if (--t.users > 0)
+                    return;
+
+                // Unlink it from its hash chain
+                Template first = templates[t.hash];
+                if (first == t)
+                {
+                    if (t.next == null)
+                        templates.Remove(t.hash);
+                    else
+                        templates[t.hash] = t.next;
+                }
+                else
+                {
+                    while (first.next != t)
+                        first = first.next;
+                    first.next = t.next;
+                }
+
+                release_pages(vmem, t.addr, t.len);
+            }
+        }
+
+        /** <summary>Unmap a range, freeing each page unless another mapping shares it</summary> */
+        static void release_pages(VirtMem vmem, ulong addr, ulong len)
+        {
+            var pm = Program.arch.PhysMem;
+            for (ulong offset = 0; offset < len; offset += vmem.PageSize)
+            {
+                ulong paddr = vmem.Unmap(addr + offset);
+                if (paddr != 0)
+                    pm.ReleaseMapped(paddr);
+            }
+        }
+    }
+}
@@ -0,0 +1,82 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Allocation trace recorder
+ * 
+ * If gc.TraceAllocations is set (the gctrace kernel command line option), every
+ * allocation and every reference store reported to the write barrier is written to the
+ * debug output as a line of the form:
+ * 
+ *  gctrace: A <address> <size> <noscan>
+ *  gctrace: W <slot> <value>
+ * 
+ * with addresses in hex and the size in decimal.  GcTestHost can replay a log containing
+ * these lines against gengc on the host.  Writing to the debug output does not allocate,
+ * so the recorder cannot recurse into the heap.
+ */
+
+namespace tysos.gc
+{
+    class alloc_trace
+    {
+        static int trace_lock = 0;
+
+        static void lock_trace()
+        {
+            while (System.Threading.Interlocked.CompareExchange(ref trace_lock, 1, 0) != 0) ;
+        }
+
+        static void unlock_trace()
+        {
+            trace_lock = 0;
+        }
+
+        internal static void Alloc(ulong addr, ulong size, bool noscan)
+        {
+            var o = Program.arch.DebugOutput;
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock_trace();
+            Formatter.Write("gctrace: A ", o);
+            Formatter.Write(addr, "X", o);
+            Formatter.Write(' ', o);
+            Formatter.Write(size, o);
+            Formatter.Write(noscan ? " 1" : " 0", o);
+            Formatter.WriteLine(o);
+            unlock_trace();
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+        }
+
+        internal static unsafe void Store(ulong slot)
+        {
+            var o = Program.arch.DebugOutput;
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            lock_trace();
+            Formatter.Write("gctrace: W ", o);
+            Formatter.Write(slot, "X", o);
+            Formatter.Write(' ', o);
+            Formatter.Write(*(ulong*)slot, "X", o);
+            Formatter.WriteLine(o);
+            unlock_trace();
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+        }
+    }
+}
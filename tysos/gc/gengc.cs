@@ -37,7 +37,7 @@
  *              11  - grey (reachable but its internal pointers not scanned yet)
  *  bit 2:      0   - young generation
  *              1   - old generation
- *  bit 3:      reserved
+ *  bit 3:      object contains no references (is not scanned by the collector)
  *  
  *  Then following the bitmap come the objects themselves aligned on a native int boundary
  *  
@@ -54,7 +54,8 @@
  *  
  * The first 4 bits of flags are as per the small object bitmap.  Bit 4 is a flag denoting
  * whether the chunk contains a small object array or a large object (0 for small object
- * array, 1 for large object).  Bit 5 denotes a root header chunk.
+ * array, 1 for large object).  Bit 5 denotes a root header chunk.  Bit 6 denotes
+ * a large object which contains no references.
  * 
  * 
  */
@@ -68,8 +69,6 @@ namespace tysos.gc
 {
     unsafe partial class gengc
     {
-        /* The number of allocations since the last collection */
-        int allocs = 0;
         internal int ready = 0;
 
         /* tree_idx determines which tree is being used:
@@ -98,6 +97,10 @@ namespace tysos.gc
             public int free_count;
             public sma_header* next;
             public int* global_free_count;
+            public int owner;           // cpu id of the allocation buffer which owns it, or -1
+            public int next_free;       // bitmap index before which there are no free objects
+            public int young_count;     // allocated objects which are not yet promoted
+            public int sweep_epoch;     // mark_epoch when last swept - see gengc_sweep.cs
         }
 
         struct root_header
@@ -118,6 +121,7 @@ namespace tysos.gc
             public chunk_header* last_free_chunk;
             public int used_chunks, free_chunks;
             public root_header* roots;
+            public alloc_buffer_header* alloc_buffers;
             public int lo_size;
 
             /* Following this is a C-style array of sma_header * pointers, followed
@@ -133,6 +137,7 @@ namespace tysos.gc
 
         static int[] sm_sizes; 
         static int[] sm_total_counts; 
+        static byte[] sm_index_lut;     // sm_sizes index for each 8-byte multiple of length
         
         public void Init(void *start, void *end)
         {
@@ -150,6 +155,10 @@ namespace tysos.gc
             if (sm_sizes.Length != sm_total_counts.Length)
                 throw new Exception("sm_sizes and sm_total_counts are not of the same length");
 
+            end = init_los(start, end);
+            end = init_page_table(start, end);
+            end = init_card_table(start, end);
+
             heap_start = start;
             heap_end = end;
 
@@ -157,6 +166,8 @@ namespace tysos.gc
             hdr = (heap_header*)start;
             hdr->used_chunks = 0;
             hdr->free_chunks = 0;
+            hdr->roots = null;
+            hdr->alloc_buffers = null;
 
             Formatter.Write("gengc: hdr = ", Program.arch.DebugOutput);
             Formatter.Write((ulong)hdr, "X", Program.arch.DebugOutput);
@@ -210,6 +221,15 @@ namespace tysos.gc
 
             hdr->lo_size = sm_sizes[sm_sizes.Length - 1];
 
+            /* Build the size class lookup table */
+            sm_index_lut = new byte[hdr->lo_size / 8 + 1];
+            for (int i = 0, j = 0; i < sm_index_lut.Length; i++)
+            {
+                while (sm_sizes[j] < i * 8)
+                    j++;
+                sm_index_lut[i] = (byte)j;
+            }
+
             /* Allocate an array for the array of next free sm arrays */
             for(int i = 0; i < sm_sizes.Length; i++)
             {
@@ -217,31 +237,47 @@ namespace tysos.gc
                 *get_sm_free_ptr(i) = 0;
             }
 
+            allocate_mark_workers();
+
             ready = 1;
         }
 
         public void *Alloc(int length)
         {
+            return Alloc(length, false);
+        }
+
+        /** <summary>Allocate an object.  If noscan is set, the object is known to contain
+         * no references (e.g. an array of a primitive type) and the collector will not
+         * look inside it</summary> */
+        public void *Alloc(int length, bool noscan)
+        {
+            /* Small objects normally come from the current cpu's allocation buffer */
+            if (length <= hdr->lo_size && length > 0)
+            {
+                void* buf_ret;
+                if (buffer_alloc(length, noscan, out buf_ret))
+                    return buf_ret;
+            }
+
             /* Wait for all other allocations and collections to complete */
             var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            acquire_alloc();
 
-            bool can_continue = false;
-            while(can_continue == false)
+            allocated_bytes += length;
+
+            /* Big enough objects get pages of their own, which are released when they die */
+            if (length >= los_min_pages << 12)
             {
-                libsupcs.Monitor.Enter(collection_mutex);
+                void* los_ret = los_alloc(length, noscan);
+                if (los_ret != null)
                 {
-                    if(collection_in_progress == false && alloc_in_progress == false)
-                    {
-                        alloc_in_progress = true;
-                        can_continue = true;
-                    }
+                    alloc_in_progress = false;
+                    libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                    return los_ret;
                 }
-                libsupcs.Monitor.Exit(collection_mutex);
             }
 
-            /* Increase the allocation counter */
-            allocs++;
-
             /* Decide if we want a large or small object */
             if(length > hdr->lo_size)
             {
@@ -249,7 +285,13 @@ namespace tysos.gc
                 alloc_in_progress = false;
 
                 if (c == null)
+                {
+                    libsupcs.OtherOperations.ExitUninterruptibleSection(state);
                     return null;
+                }
+                if (noscan)
+                    c->flags |= 1 << 6;
+                c->flags = (c->flags & ~0x3) | (int)alloc_colour;
                 var ret = (void*)((byte*)c + sizeof(chunk_header));
                 libsupcs.OtherOperations.ExitUninterruptibleSection(state);
                 return ret;
@@ -261,6 +303,7 @@ namespace tysos.gc
                 if (sm_index < 0)
                 {
                     alloc_in_progress = false;
+                    libsupcs.OtherOperations.ExitUninterruptibleSection(state);
                     return null;
                 }
 
@@ -268,12 +311,15 @@ namespace tysos.gc
                 sma_header** sma_ptr = get_sma_ptr(sm_index);
                 int* sm_free_ptr = get_sm_free_ptr(sm_index);
 
-                /* Ensure there is free space of the appropriate size */
+                /* Ensure there is free space of the appropriate size, sweeping arrays
+                 * left over from the last collection first */
+                if(*sm_free_ptr == 0)
+                    sweep_shared_arrays(*sma_ptr);
                 if(*sm_free_ptr == 0)
                     allocate_sma_header(sma_ptr, sm_index);
 
                 /* Allocate space */
-                void *ret = allocate_small_object(*sma_ptr, sm_index);
+                void *ret = allocate_small_object(*sma_ptr, sm_index, noscan);
 
                 if(ret == null)
                 {
@@ -282,7 +328,7 @@ namespace tysos.gc
                     Formatter.Write(".  Trying again... ", Program.arch.DebugOutput);
 
                     allocate_sma_header(sma_ptr, sm_index);
-                    ret = allocate_small_object(*sma_ptr, sm_index);
+                    ret = allocate_small_object(*sma_ptr, sm_index, noscan);
 
                     if (ret == null)
                         Formatter.WriteLine("failed again", Program.arch.DebugOutput);
@@ -295,6 +341,25 @@ namespace tysos.gc
             }            
         }
 
+        /** <summary>Wait for all other shared heap allocations and collections to complete,
+         * then set alloc_in_progress</summary> */
+        void acquire_alloc()
+        {
+            bool can_continue = false;
+            while(can_continue == false)
+            {
+                libsupcs.Monitor.Enter(collection_mutex);
+                {
+                    if(collection_in_progress == false && alloc_in_progress == false)
+                    {
+                        alloc_in_progress = true;
+                        can_continue = true;
+                    }
+                }
+                libsupcs.Monitor.Exit(collection_mutex);
+            }
+        }
+
         sma_header** get_sma_ptr(int sm_index)
         {
             return (sma_header**)((byte*)hdr + sizeof(heap_header) +
@@ -308,12 +373,13 @@ namespace tysos.gc
                 sm_index * sizeof(int));
         }
 
-        private unsafe void* allocate_small_object(sma_header* sma_header, int sm_index)
+        private unsafe void* allocate_small_object(sma_header* sma_header, int sm_index, bool noscan)
         {
             sma_header* cur_hdr = sma_header;
 
             while(cur_hdr != null)
             {
+                ensure_swept(cur_hdr);
                 if(cur_hdr->free_count == 0)
                 {
                     cur_hdr = cur_hdr->next;
@@ -332,42 +398,34 @@ namespace tysos.gc
                     if ((*test & 0x3) == 0)
                     {
                         free = 0;
-                        *test |= 0x1;
                     }
                     else if ((*test & 0x30) == 0)
                     {
                         free = 1;
-                        *test |= 0x10;
                     }
                     else if ((*test & 0x300) == 0)
                     {
                         free = 2;
-                        *test |= 0x100;
                     }
                     else if ((*test & 0x3000) == 0)
                     {
                         free = 3;
-                        *test |= 0x1000;
                     }
                     else if ((*test & 0x30000) == 0)
                     {
                         free = 4;
-                        *test |= 0x10000;
                     }
                     else if ((*test & 0x300000) == 0)
                     {
                         free = 5;
-                        *test |= 0x100000;
                     }
                     else if ((*test & 0x3000000) == 0)
                     {
                         free = 6;
-                        *test |= 0x1000000;
                     }
                     else if ((*test & 0x30000000) == 0)
                     {
                         free = 7;
-                        *test |= 0x10000000;
                     }
 
                     if(free != -1)
@@ -382,8 +440,11 @@ namespace tysos.gc
                         Formatter.WriteLine(Program.arch.DebugOutput);
 #endif
 
+                        *test |= (noscan ? alloc_colour | 0x8U : alloc_colour) << (free * 4);
+
                         /* Return index i + free */
-                        sma_header->free_count -= 1;
+                        cur_hdr->free_count -= 1;
+                        cur_hdr->young_count++;
                         *get_sm_free_ptr(sm_index) -= 1;
                         return (void*)((byte*)cur_hdr + sizeof(sma_header) +
                             cur_hdr->total_count * 4 +
@@ -417,6 +478,11 @@ namespace tysos.gc
             h->total_count = obj_count;
             h->next = old_entry;
             h->global_free_count = get_sm_free_ptr(sm_index);
+            h->owner = -1;
+            h->next_free = 0;
+            h->young_count = 0;
+            h->sweep_epoch = mark_epoch;
+            sma_count++;
 
             /* Add our free blocks to the total free count */
             *get_sm_free_ptr(sm_index) += obj_count;
@@ -426,7 +492,7 @@ namespace tysos.gc
             {
                 /* Each 32-bit test uint covers 8 entries of 4 bits */
                 uint* test = (uint*)((byte*)h + sizeof(sma_header) +
-                    i * 4);
+                    i / 2);
                 *test = 0;
             }
 
@@ -497,23 +563,23 @@ namespace tysos.gc
             chk->left = hdr->nil;
             chk->right = hdr->nil;
             chk->lock_object = 0;
-            chk->flags = 1 << 4 | 1;    // large block, white
+            chk->flags = 1 << 4 | 1;    // large block, white, young
             
             chk->red = 0;
 
+            extend_heap_top((byte*)chk + sizeof(chunk_header) + act_length);
+
             RBTreeInsert(hdr, 1, chk);
+            map_chunk_pages(chk);
 
             return chk;
         }
 
         int get_size_index(int size)
         {
-            for(int i = 0; i < sm_sizes.Length; i++)
-            {
-                if (size <= sm_sizes[i])
-                    return i;
-            }
-            return -1;
+            if (size < 0 || size > hdr->lo_size)
+                return -1;
+            return sm_index_lut[(size + 7) / 8];
         }
 
         int Compare(chunk_header *a, chunk_header *b, int tree_idx)
@@ -694,7 +760,16 @@ namespace tysos.gc
              * 
              * First, get the chunk that contains the object */
 
-            chunk_header* chk = search(hdr, 1, 1, (byte*)obj);
+            if (obj >= los_start && obj < los_end)
+            {
+                byte* obj_start;
+                los_slot* s = find_los_slot((byte*)obj, out obj_start);
+                if (s == null)
+                    return -1;
+                return s->flags & 0x3;
+            }
+
+            chunk_header* chk = find_chunk((byte*)obj);
             if (chk == null)
                 return -1;
 
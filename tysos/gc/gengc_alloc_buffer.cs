@@ -0,0 +1,231 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Per-cpu allocation buffers for small objects
+ * 
+ * Each cpu owns, for each entry in sm_sizes, a whole small object array which is
+ * not on the shared list in the heap header.  Allocation from it is a probe of its
+ * bitmap starting at its next_free hint, with interrupts disabled, and does not touch
+ * any state shared with other cpus.  Only when the owned array is exhausted do we take
+ * the shared allocation lock, return the array to the shared list and take (or create)
+ * another one.
+ * 
+ * The collector has to exclude buffer allocations whilst it runs.  An allocating cpu
+ * sets in_alloc in its buffer before checking collection_in_progress, and the collector
+ * waits for in_alloc to be clear on every buffer after setting collection_in_progress.
+ * Both sides use a locked instruction so that neither load can pass the other's store.
+ */
+
+namespace tysos.gc
+{
+    unsafe partial class gengc
+    {
+        struct alloc_buffer_header
+        {
+            public int in_alloc;
+            public long bytes;          // allocated since the total was last updated
+            public alloc_buffer_header* next;
+
+            /* Following this is a C-style array of sma_header * pointers, one for each
+             * entry in sm_sizes */
+        }
+
+        sma_header** get_buffer_sma_ptr(alloc_buffer_header* b, int sm_index)
+        {
+            return (sma_header**)((byte*)b + sizeof(alloc_buffer_header) +
+                sm_index * sizeof(sma_header*));
+        }
+
+        /** <summary>Allocate a small object from the current cpu's allocation buffer.  Returns
+         * false if there is no buffer available, in which case the shared heap should be used</summary> */
+        bool buffer_alloc(int length, bool noscan, out void* ret)
+        {
+            ret = null;
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+            Cpu cpu = Program.arch.CurrentCpu;
+            if (cpu == null)
+            {
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                return false;
+            }
+
+            int sm_index = get_size_index(length);
+            alloc_buffer_header* b = (alloc_buffer_header*)cpu.gc_alloc_buffer;
+
+            if (b != null)
+            {
+                System.Threading.Interlocked.CompareExchange(ref b->in_alloc, 1, 0);
+                if (collection_in_progress == false)
+                {
+                    sma_header* s = *get_buffer_sma_ptr(b, sm_index);
+                    if (s != null)
+                    {
+                        ensure_swept(s);
+                        if (s->free_count > 0)
+                            ret = sma_take(s, noscan);
+                    }
+                    if (ret != null)
+                        b->bytes += sm_sizes[sm_index];
+                }
+                b->in_alloc = 0;
+
+                if (ret != null)
+                {
+                    libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                    return true;
+                }
+            }
+
+            /* Slow path - refill the buffer from the shared heap */
+            acquire_alloc();
+            if (b == null)
+                b = allocate_alloc_buffer(cpu);
+            if (b != null)
+            {
+                allocated_bytes += b->bytes + sm_sizes[sm_index];
+                b->bytes = 0;
+
+                sma_header* s = refill_buffer(b, sm_index, cpu.Id);
+                if (s != null)
+                    ret = sma_take(s, noscan);
+            }
+            alloc_in_progress = false;
+
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return ret != null;
+        }
+
+        /** <summary>Take a free object from a small object array, searching the bitmap
+         * from its next_free hint</summary> */
+        void* sma_take(sma_header* s, bool noscan)
+        {
+            byte* data_start = (byte*)s + sizeof(sma_header) + s->total_count * 4;
+
+            for (int i = s->next_free; i < s->total_count; i += 8)
+            {
+                /* Each 32-bit test uint covers 8 entries of 4 bits.  An entry is free if
+                 * neither of its colour bits is set. */
+                uint* test = (uint*)((byte*)s + sizeof(sma_header) + i / 2);
+                uint free = ~(*test | (*test >> 1)) & 0x11111111U;
+                if (free == 0)
+                    continue;
+
+                int bit_idx = util.HighestSetBit(free & (~free + 1)) / 4;
+                /* The collector may be shading other objects in this word */
+                atomic_or(test, (noscan ? alloc_colour | 0x8U : alloc_colour) << (bit_idx * 4));
+
+                s->next_free = i;
+                s->free_count--;
+                s->young_count++;
+                return data_start + (i + bit_idx) * s->obj_length;
+            }
+
+            /* free_count was wrong - don't try this array again until it is swept */
+            s->free_count = 0;
+            return null;
+        }
+
+        /** <summary>Give a buffer's exhausted array for sm_index back to the shared list and
+         * take one which has free space.  Must be called with alloc_in_progress set.</summary> */
+        sma_header* refill_buffer(alloc_buffer_header* b, int sm_index, int owner)
+        {
+            sma_header** sma_ptr = get_sma_ptr(sm_index);
+            int* sm_free_ptr = get_sm_free_ptr(sm_index);
+            sma_header** buf_ptr = get_buffer_sma_ptr(b, sm_index);
+
+            sma_header* old = *buf_ptr;
+            if (old != null)
+            {
+                old->owner = -1;
+                old->next = *sma_ptr;
+                *sma_ptr = old;
+                *sm_free_ptr += old->free_count;
+                *buf_ptr = null;
+            }
+
+            /* Find a shared array with free space, or create a new one */
+            sma_header** prev_ptr = sma_ptr;
+            sma_header* s = *sma_ptr;
+            while (s != null)
+            {
+                ensure_swept(s);
+                if (s->free_count != 0)
+                    break;
+                prev_ptr = &s->next;
+                s = s->next;
+            }
+            if (s == null)
+            {
+                s = (sma_header*)allocate_sma_header(sma_ptr, sm_index);
+                if (s == null)
+                    return null;
+                prev_ptr = sma_ptr;
+            }
+
+            /* Remove it from the shared list */
+            *prev_ptr = s->next;
+            s->next = null;
+            *sm_free_ptr -= s->free_count;
+            s->owner = owner;
+
+            *buf_ptr = s;
+            return s;
+        }
+
+        /** <summary>Create the allocation buffer for a cpu.  Must be called with
+         * alloc_in_progress set.</summary> */
+        alloc_buffer_header* allocate_alloc_buffer(Cpu cpu)
+        {
+            chunk_header* chk = allocate_chunk(sizeof(alloc_buffer_header) +
+                sm_sizes.Length * sizeof(sma_header*));
+            if (chk == null)
+                return null;
+            chk->flags &= ~(1 << 4);        // not large block
+            chk->flags |= 1 << 5;           // not a small object array either
+
+            alloc_buffer_header* b = (alloc_buffer_header*)((byte*)chk + sizeof(chunk_header));
+            b->in_alloc = 0;
+            b->bytes = 0;
+            for (int i = 0; i < sm_sizes.Length; i++)
+                *get_buffer_sma_ptr(b, i) = null;
+
+            b->next = hdr->alloc_buffers;
+            hdr->alloc_buffers = b;
+
+            cpu.gc_alloc_buffer = b;
+            return b;
+        }
+
+        /** <summary>Wait for any buffer allocations which started before
+         * collection_in_progress was set to complete</summary> */
+        void wait_for_alloc_buffers()
+        {
+            alloc_buffer_header* b = hdr->alloc_buffers;
+            while (b != null)
+            {
+                while (System.Threading.Interlocked.CompareExchange(ref b->in_alloc, 0, 0) != 0) ;
+                b = b->next;
+            }
+        }
+    }
+}
@@ -0,0 +1,219 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Card table and minor collections for gengc
+ * 
+ * Objects start in the young generation.  gengc does not move objects, so an object
+ * is promoted simply by setting the old generation bit (bit 2 of its flags) when it
+ * survives a collection.
+ * 
+ * A minor collection only marks and frees young objects: old objects are treated as
+ * live and are not traced.  Its roots are the usual root blocks plus any references
+ * from old objects to young ones.  To find those, the heap is divided into cards of
+ * 1 << card_shift bytes, and every store of a reference into a heap object must be
+ * followed by a call to gcwritebarrier, which marks the card containing the stored-to
+ * slot dirty.  A minor collection scans the dirty cards.  All
+ * survivors of any collection are old, so afterwards there are no old to young
+ * references and every card is clean.
+ * 
+ * Only the old objects within a dirty card are scanned, as a young object would be
+ * traced anyway if it is reachable.
+ * 
+ * The card table lives at the top of the heap's address range, so its pages are only
+ * mapped as the part of the heap below heap_top is used.
+ * 
+ * Minor collections are only safe if the code which is running emits the write
+ * barrier for every reference store, and so are disabled unless MinorCollections
+ * is set.
+ */
+
+namespace tysos.gc
+{
+    unsafe partial class gengc
+    {
+        /** <summary>Set if all reference stores to the heap call gcwritebarrier, enabling
+         * minor collections</summary> */
+        public static bool MinorCollections = false;
+
+        /** <summary>The number of minor collections to run between full ones</summary> */
+        public static int MinorsPerFull = 8;
+
+        const int card_shift = 9;
+
+        byte* card_table = null;
+        byte* heap_top = null;          // end of the highest chunk ever allocated
+        int minors_since_full = 0;
+        bool minor_in_progress = false;
+
+        /** <summary>Reserve the card table at the top of [start, end).  Returns the new end
+         * of the space available for chunks</summary> */
+        void* init_card_table(void* start, void* end)
+        {
+            ulong card_count = (ulong)((byte*)end - (byte*)start) >> card_shift;
+            card_count = util.align(card_count, 0x1000);
+
+            card_table = (byte*)end - card_count;
+            heap_top = (byte*)start;
+            return card_table;
+        }
+
+        /** <summary>Called when a chunk is carved out, so that the part of the card table
+         * in use grows with the heap</summary> */
+        void extend_heap_top(byte* chunk_end)
+        {
+            if (chunk_end <= heap_top)
+                return;
+
+            /* The new cards cannot yet contain any old objects.  The card containing the old
+             * heap_top may already be dirty, so start at the one after it. */
+            byte* first = card_table + (((byte*)heap_top - (byte*)heap_start + (1 << card_shift) - 1) >> card_shift);
+            byte* last = card_table + ((chunk_end - 1 - (byte*)heap_start) >> card_shift);
+            if (last >= first)
+                libsupcs.MemoryOperations.MemSet(first, 0, (int)(last - first + 1));
+
+            clear_page_entries(heap_top, chunk_end);
+            heap_top = chunk_end;
+        }
+
+        /** <summary>Record that a reference has been stored to slot</summary> */
+        public void WriteBarrier(void* slot)
+        {
+            if (slot >= heap_start && slot < heap_top)
+            {
+                card_table[((byte*)slot - (byte*)heap_start) >> card_shift] = 1;
+                if (incremental_marking)
+                    shade_slot(slot);
+            }
+            else if (slot >= los_start && slot < los_end)
+            {
+                los_write_barrier(slot);
+                if (incremental_marking)
+                    shade_slot(slot);
+            }
+        }
+
+        /** <summary>Grey any young objects referenced from old objects in dirty cards,
+         * cleaning them</summary> */
+        void scan_dirty_cards(mark_worker* w)
+        {
+            int card_count = (int)(((byte*)heap_top - (byte*)heap_start + (1 << card_shift) - 1) >> card_shift);
+
+            for (int i = 0; i < card_count; i++)
+            {
+                if (card_table[i] == 0)
+                    continue;
+                card_table[i] = 0;
+
+                byte* card_start = (byte*)heap_start + ((long)i << card_shift);
+                byte* card_end = card_start + (1 << card_shift);
+                if (card_end > heap_top)
+                    card_end = heap_top;
+
+                scan_card(w, card_start, card_end);
+            }
+
+            scan_dirty_los(w);
+        }
+
+        /** <summary>Scan the parts of old objects which lie within a card</summary> */
+        void scan_card(mark_worker* w, byte* card_start, byte* card_end)
+        {
+            /* Start at the chunk containing the card start, or the one before it */
+            chunk_header* chk = search(hdr, 1, 1, card_start);
+            if (chk == null)
+            {
+                chk = hdr->root_used_chunk;
+                while (chk->left != hdr->nil)
+                    chk = chk->left;
+            }
+
+            while (chk != hdr->nil && (byte*)chk < card_end)
+            {
+                byte* chk_start = (byte*)chk + sizeof(chunk_header);
+                byte* chk_end = chk_start + (int)chk->length;
+
+                if (chk_end > card_start)
+                {
+                    if ((chk->flags & 0x30) == 0x10)
+                    {
+                        /* large object */
+                        if ((chk->flags & 0x4) != 0 && (chk->flags & (1 << 6)) == 0)
+                            grey_object(w, chk_start > card_start ? chk_start : card_start,
+                                chk_end < card_end ? chk_end : card_end);
+                    }
+                    else if ((chk->flags & 0x30) == 0x0)
+                        scan_card_sma(w, (sma_header*)chk_start, card_start, card_end);
+                }
+
+                chk = TreeSuccessor(hdr, 1, chk);
+            }
+        }
+
+        void scan_card_sma(mark_worker* w, sma_header* smhdr, byte* card_start, byte* card_end)
+        {
+            byte* data_start = (byte*)smhdr + sizeof(sma_header) + smhdr->total_count * 4;
+            int first = 0;
+            if (card_start > data_start)
+                first = (int)((card_start - data_start) / smhdr->obj_length);
+
+            for (int idx = first; idx < smhdr->total_count; idx++)
+            {
+                byte* obj_start = data_start + idx * smhdr->obj_length;
+                if (obj_start >= card_end)
+                    break;
+
+                /* Only old objects which may contain references */
+                uint* uint_ptr = (uint*)((byte*)smhdr + sizeof(sma_header) + idx / 8 * 4);
+                uint nibble = (*uint_ptr >> (idx % 8 * 4)) & 0xfU;
+                if ((nibble & 0x3) == 0 || (nibble & 0xc) != 0x4)
+                    continue;
+
+                byte* obj_end = obj_start + smhdr->obj_length;
+                grey_object(w, obj_start > card_start ? obj_start : card_start,
+                    obj_end < card_end ? obj_end : card_end);
+            }
+        }
+
+        void clear_cards()
+        {
+            int card_count = (int)(((byte*)heap_top - (byte*)heap_start + (1 << card_shift) - 1) >> card_shift);
+            libsupcs.MemoryOperations.MemSet(card_table, 0, card_count);
+        }
+
+        /** <summary>Continue an incremental collection by one step if one is in progress.
+         * Otherwise run a minor collection if MinorCollections is set, fewer than
+         * MinorsPerFull have run since the last full one and the old generation is not full
+         * (see old_generation_full()).  Otherwise start a full collection, which is
+         * incremental if IncrementalCollections is set (see RunIncrementalSteps())</summary> */
+        public void Collect()
+        {
+            if (incremental_marking)
+                incremental_step(IncrementalPauseBudget);
+            else if (MinorCollections && minors_since_full < MinorsPerFull && !old_generation_full())
+                DoMinorCollection();
+            else if (IncrementalCollections)
+                incremental_step(IncrementalPauseBudget);
+            else
+                DoCollection();
+        }
+    }
+}
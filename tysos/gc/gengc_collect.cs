@@ -27,61 +27,65 @@ namespace tysos.gc
         bool alloc_in_progress = false;
         object collection_mutex = new object();
 
+        /* Objects which have been greyed but not yet scanned.  If it fills, further grey
+         * objects are left for a scan of the whole heap (mark_overflow). */
+        struct mark_entry
+        {
+            public byte* start;
+            public byte* end;
+            public uint* colour;        // word containing the object's colour bits
+            public int shift;           // position of the colour bits within it
+        }
+
+        const int mark_stack_capacity = 2048;
+        bool mark_overflow = false;
+
+        /** <summary>Run a full collection</summary> */
         public void DoCollection()
         {
-            /* We only want one collection to run at once.  If we just used a lock{} section,
-             * then all threads that request a collection whilst one is already running would
-             * have to wait for the current collection to finish, then run one themselves
-             * immediately afterwards.  This is wasteful as they can just rely on the already
-             * running collection to be good enough.
-             * 
-             * Thus, we protect the entry to the function so only one thread can check if a
-             * collection is running and immediately start one if it isn't.  This is a short
-             * code block so other threads won't have to wait long, they will then see the
-             * collection_in_progress flag is true and exit.
-             * 
-             * The flag is reset at function exit atomically so no need for to reacquire the
-             * mutex.
-             */
+            DoCollection(false);
+        }
 
-            bool can_continue = false;
+        /** <summary>Run a minor collection, which only frees young objects.  Only valid if
+         * MinorCollections is set.</summary> */
+        public void DoMinorCollection()
+        {
+            DoCollection(MinorCollections);
+        }
 
-            while (can_continue == false)
+        void DoCollection(bool minor)
+        {
+            if (incremental_marking)
             {
-                libsupcs.Monitor.Enter(collection_mutex);
-                {
-                    if (collection_in_progress)
-                    {
-                        Formatter.WriteLine("gengc: attempt to run collection whilst already in progress",
-                            Program.arch.DebugOutput);
-                        libsupcs.Monitor.Exit(collection_mutex);
-                        libsupcs.OtherOperations.AsmBreakpoint();
-                        return;
-                    }
-
-                    if (alloc_in_progress == false)
-                    {
-                        collection_in_progress = true;
-                        can_continue = true;
-                    }
-                }
-                libsupcs.Monitor.Exit(collection_mutex);
+                /* Finish the incremental collection which is already running instead */
+                while (incremental_step(0) == false) ;
+                return;
             }
 
+            if (begin_collection() == false)
+                return;
+
+            finish_lazy_sweep();
+            reset_marked_bytes();
+            minor_in_progress = minor;
+
             /* Run a collection.  Process is:
              * 
              * 1)       Whiten all objects (all chunks/small objects that are not root blocks)
              *              (this is done implicitly on assignment and on freeing)
-             * 2)       Grey those listed in a root block
-             * 3a)      Set blackened_count to 0
-             * 3b)      Iterate though all blocks.  If a grey is encountered:
-             * 3b.1)        Iterate through the object on native int boundaries
-             * 3b.2)        Grey all white objects it points to
-             * 3b.3)        Blacken the object
-             * 3b.4)        blackened_count++
-             * 3c)      If blackened_count > 0 loop to 3a
+             * 2)       Grey those listed in a root block, pushing them on to the mark stack
+             * 2a)      For a minor collection, also grey young objects referenced from
+             *              dirty cards.  Old objects are never greyed.
+             * 3)       Pop objects from the mark stack until it is empty:
+             * 3.1)         Iterate through the object on native int boundaries
+             * 3.2)         Grey all white objects it points to, pushing them
+             * 3.3)         Blacken the object
+             * 3a)      If the mark stack overflowed, iterate through all blocks blackening
+             *              grey objects as in 3.1-3.3, then loop to 3
              * 4)       Iterate through again, reclaiming white blocks to be free, and
-             *              whitening black blocks (there should be no grey blocks now)
+             *              whitening and promoting black blocks (there should be no grey
+             *              blocks now).  A minor collection leaves old blocks alone.
+             *              Small object arrays are swept later (see gengc_sweep.cs)
              */
 
 #if GENGC_BASICDEBUG
@@ -92,225 +96,65 @@ namespace tysos.gc
 #if GENGC_BASICDEBUG
             Formatter.WriteLine("gengc: greying roots... ", Program.arch.DebugOutput);
 #endif
-            root_header* cur_root_hdr = hdr->roots;
-            while(cur_root_hdr != null)
-            {
-                for(int i = 0; i < cur_root_hdr->size; i++)
-                {
-                    byte* root_start = *(byte**)((byte*)cur_root_hdr + sizeof(root_header) +
-                        i * 2 * sizeof(byte*));
-                    byte* root_end = *(byte**)((byte*)cur_root_hdr + sizeof(root_header) +
-                        (i * 2 + 1) * sizeof(byte*));
-
-                    grey_object(root_start, root_end);
-
-#if GENGC_DEBUG
-                    Formatter.Write((ulong)root_start, "X", Program.arch.DebugOutput);
-                    Formatter.Write(" - ", Program.arch.DebugOutput);
-                    Formatter.Write((ulong)root_end, "X", Program.arch.DebugOutput);
-                    Formatter.WriteLine(Program.arch.DebugOutput);
-#endif
-                }
-                cur_root_hdr = cur_root_hdr->next;
-            }
+            mark_worker* w0 = get_mark_worker(0);
+            grey_roots(w0);
+            if (minor)
+                scan_dirty_cards(w0);
 #if GENGC_BASICDEBUG
             Formatter.WriteLine("done", Program.arch.DebugOutput);
 #endif
 
+            finish_collection(minor);
+        }
+
+        /** <summary>Mark everything reachable from the grey objects, then sweep</summary> */
+        void finish_collection(bool minor)
+        {
+            mark_worker* w0 = get_mark_worker(0);
+
             /* blacken reachable blocks */
 #if GENGC_BASICDEBUG
             Formatter.Write("gengc: blackening reachable blocks... ", Program.arch.DebugOutput);
 #endif
-            int blackened_count;
             int total_blackened = 0;
-            int small_blackened = 0;
-            int large_blackened = 0;
             int loops = 0;
-            int block_count = 0;        // debugging count to ensure we traverse the whole tree
-            chunk_header* chk;
 
-            do
+            while (true)
             {
-                blackened_count = 0;
-                block_count = 0;
-                /* Iterate all blocks */
-
-                // Get the first block
-                chk = hdr->root_used_chunk;
-                while (chk->left != hdr->nil)
-                    chk = chk->left;
-                
-                while(chk != hdr->nil)
-                {
-                    block_count++;
-
-                    if((chk->flags & 0x30) == 0x10)
-                    {
-                        /* large object - is it grey? */
-                        if((chk->flags & 0x3) == 0x3)
-                        {
-                            byte* obj_start = (byte*)chk + sizeof(chunk_header);
-                            byte* obj_end = obj_start + (int)chk->length;
-
-                            /* grey all it points to */
-                            grey_object(obj_start, obj_end);
-
-                            /* blacken the object */
-                            chk->flags &= ~0x1;
-                            blackened_count++;
-                            large_blackened++;
-
-#if GENGC_DEBUG
-                            Formatter.Write("gengc: INFO: greying large object: ", Program.arch.DebugOutput);
-                            Formatter.Write((ulong)obj_start, "X", Program.arch.DebugOutput);
-                            Formatter.Write(" - ", Program.arch.DebugOutput);
-                            Formatter.Write((ulong)obj_end, "X", Program.arch.DebugOutput);
-                            Formatter.WriteLine(Program.arch.DebugOutput);
-#endif
-                        }
-                    }
-                    else if ((chk->flags & 0x30) == 0x0)
-                    {
-                        /* small object array, iterate through each */
-                        sma_header* smhdr = (sma_header*)((byte*)chk + sizeof(chunk_header));
-
-                        for(int i = 0; i < smhdr->total_count; i += 8)
-                        {
-                            uint* uint_ptr = (uint*)((byte*)smhdr + sizeof(sma_header) +
-                                i / 2);
-
-                            for (int bit_idx = 0; bit_idx < 8; bit_idx++)
-                            {
-                                uint flag_pattern = 0x3U << (bit_idx * 4);
-                                uint grey_pattern = 0x3U << (bit_idx * 4);
-                                uint black_pattern = 0x2U << (bit_idx * 4);
-
-                                if ((*uint_ptr & flag_pattern) == grey_pattern)
-                                {
-                                    byte* data_start = (byte*)smhdr + sizeof(sma_header) +
-                                        smhdr->total_count * 4;
-                                    byte* obj_start = data_start + (i + bit_idx) *
-                                        smhdr->obj_length;
-                                    byte* obj_end = obj_start + smhdr->obj_length;
-
-                                    /* grey all it points to */
-                                    grey_object(obj_start, obj_end);
-
-                                    /* blacken the object */
-                                    *uint_ptr &= ~flag_pattern;
-                                    *uint_ptr |= black_pattern;
-                                    blackened_count++;
-                                    small_blackened++;
-                                }
-                            }
-                        }
-                    }
-                    
-                    // Loop to the next chunk
-                    chk = TreeSuccessor(hdr, 1, chk);
-                }
-
-                total_blackened += blackened_count;
+                total_blackened += parallel_mark();
                 loops++;
 
-#if GENGC_DEBUG
-                Formatter.Write("gengc: loop visited ", Program.arch.DebugOutput);
-                Formatter.Write((ulong)block_count, Program.arch.DebugOutput);
-                Formatter.WriteLine(" blocks", Program.arch.DebugOutput);
-#endif
-            } while (blackened_count > 0);
+                if (mark_overflow == false)
+                    break;
+
+                /* Some objects were greyed but did not fit on the mark stack, so find them
+                 * by scanning the heap */
+                mark_overflow = false;
+                total_blackened += scan_grey_objects(w0);
+            }
+            incremental_marking = false;
+            alloc_colour = 0x1;
 #if GENGC_BASICDEBUG
             Formatter.WriteLine("done", Program.arch.DebugOutput);
 #endif
 
-            /* Iterate through again, setting white to free and black to white */
+            /* Iterate through again, setting white to free and black to white.  Only large
+             * objects are done now - small object arrays are swept lazily afterwards. */
 #if GENGC_BASICDEBUG
             Formatter.Write("gengc: freeing white blocks... ", Program.arch.DebugOutput);
 #endif
-            // Get the first block
-            chk = hdr->root_used_chunk;
-            while (chk->left != hdr->nil)
-                chk = chk->left;
-
-            int white_large_objects = 0;
-            int white_small_objects = 0;
-            int black_large_objects = 0;
-            int black_small_objects = 0;
-            block_count = 0;
-
-            while (chk != hdr->nil)
-            {
-                block_count++;
-                if ((chk->flags & 0x30) == 0x10)
-                {
-                    /* large object - is it white? */
-                    if ((chk->flags & 0x3) == 0x3)
-                    {
-                        // TODO: delete large object
-                        // Can we do a tree node delete whilst traversal is in progress?
-                        white_large_objects++;
-                    }
-                    else if((chk->flags & 0x3) == 0x2)
-                    {
-                        // its black - set back to white
-                        chk->flags &= ~0x3;
-                        chk->flags |= 0x1;
-                        black_large_objects++;
-                    }
-                }
-
-                else if ((chk->flags & 0x30) == 0x0)
-                {
-                    /* small object array, iterate through each */
-                    sma_header* smhdr = (sma_header*)((byte*)chk + sizeof(chunk_header));
-
-                    for (int i = 0; i < smhdr->total_count; i += 8)
-                    {
-                        uint* uint_ptr = (uint*)((byte*)smhdr + sizeof(sma_header) +
-                            i / 2);
-
-                        for (int bit_idx = 0; bit_idx < 8; bit_idx++)
-                        {
-                            uint flag_pattern = 0x3U << (bit_idx * 4);
-                            uint white_pattern = 0x1U << (bit_idx * 4);
-                            uint black_pattern = 0x2U << (bit_idx * 4);
-
-                            /* debugging - check we are not freeing a process/thread etc */
-                            byte* data_start = (byte*)smhdr + sizeof(sma_header) +
-                                smhdr->total_count * 4;
-                            byte* obj_start = data_start + (i + bit_idx) *
-                                smhdr->obj_length;
-
-                            if ((*uint_ptr & flag_pattern) == white_pattern)
-                            {
-                                /* free the object */
-                                *uint_ptr &= ~flag_pattern;
-                                smhdr->free_count++;
-                                (*smhdr->global_free_count)++;
-                                white_small_objects++;
-                            }
-                            else if((*uint_ptr & flag_pattern) == black_pattern)
-                            {
-                                /* whiten the object */
-                                *uint_ptr &= ~flag_pattern;
-                                *uint_ptr |= white_pattern;
-                                black_small_objects++;
-                            }
-                            else if((*uint_ptr & flag_pattern) == flag_pattern)
-                            {
-                                Formatter.Write("gengc: WARNING: object at ", Program.arch.DebugOutput);
-                                Formatter.Write((ulong)obj_start, "X", Program.arch.DebugOutput);
-                                Formatter.Write(" is grey on final loop: ", Program.arch.DebugOutput);
-                                Formatter.Write(*uint_ptr & flag_pattern, "X", Program.arch.DebugOutput);
-                                Formatter.WriteLine(Program.arch.DebugOutput);
-                            }
-                        }
-                    }
-                }
+            begin_lazy_sweep(minor);
+#if GENGC_DEBUG
+            int block_count = parallel_sweep(minor);    // debugging count to ensure we traverse the whole tree
+#else
+            parallel_sweep(minor);
+#endif
+            sweep_los(minor);
 
-                // Loop to the next chunk
-                chk = TreeSuccessor(hdr, 1, chk);
-            }
+            int white_large_objects = swept_white_large;
+            int white_small_objects = swept_white_small;
+            int black_large_objects = swept_black_large;
+            int black_small_objects = swept_black_small;
 #if GENGC_BASICDEBUG
             Formatter.WriteLine("done", Program.arch.DebugOutput);
 #endif
@@ -341,11 +185,6 @@ namespace tysos.gc
             Formatter.Write((ulong)black_small_objects, Program.arch.DebugOutput);
             Formatter.WriteLine(" small objects not freed", Program.arch.DebugOutput);
 
-            Formatter.Write("gengc: ", Program.arch.DebugOutput);
-            Formatter.Write((ulong)large_blackened, Program.arch.DebugOutput);
-            Formatter.Write(" large objects and ", Program.arch.DebugOutput);
-            Formatter.Write((ulong)small_blackened, Program.arch.DebugOutput);
-            Formatter.WriteLine(" small objects were blackened", Program.arch.DebugOutput);
 #endif
 
 #if GENGC_BASICDEBUG
@@ -354,14 +193,133 @@ namespace tysos.gc
             Formatter.WriteLine(" objects remain in use", Program.arch.DebugOutput);
             Formatter.Write("gengc: ", Program.arch.DebugOutput);
             Formatter.Write((ulong)loops, Program.arch.DebugOutput);
-            Formatter.WriteLine(" loops required to blacken all in-use objects", Program.arch.DebugOutput);
+            Formatter.WriteLine(" mark stack drains required to blacken all in-use objects", Program.arch.DebugOutput);
 #endif
 
-            allocs = 0;
+            /* Every survivor is now old, so there are no old to young references */
+            if (minor)
+                minors_since_full++;
+            else
+            {
+                clear_cards();
+                minors_since_full = 0;
+            }
+            minor_in_progress = false;
+
+            update_trigger(minor);
             collection_in_progress = false;
         }
 
-        private unsafe void grey_object(byte* obj_start, byte* obj_end)
+        /** <summary>Wait for any allocations to finish, then set collection_in_progress.
+         * Returns false if a collection is already running</summary> */
+        bool begin_collection()
+        {
+            /* We only want one collection to run at once.  If we just used a lock{} section,
+             * then all threads that request a collection whilst one is already running would
+             * have to wait for the current collection to finish, then run one themselves
+             * immediately afterwards.  This is wasteful as they can just rely on the already
+             * running collection to be good enough.
+             * 
+             * Thus, we protect the entry to the function so only one thread can check if a
+             * collection is running and immediately start one if it isn't.  This is a short
+             * code block so other threads won't have to wait long, they will then see the
+             * collection_in_progress flag is true and exit.
+             * 
+             * The flag is reset at function exit atomically so no need for to reacquire the
+             * mutex.
+             */
+
+            bool can_continue = false;
+
+            while (can_continue == false)
+            {
+                libsupcs.Monitor.Enter(collection_mutex);
+                {
+                    if (collection_in_progress)
+                    {
+                        Formatter.WriteLine("gengc: attempt to run collection whilst already in progress",
+                            Program.arch.DebugOutput);
+                        libsupcs.Monitor.Exit(collection_mutex);
+                        libsupcs.OtherOperations.AsmBreakpoint();
+                        return false;
+                    }
+
+                    if (alloc_in_progress == false)
+                    {
+                        collection_in_progress = true;
+                        can_continue = true;
+                    }
+                }
+                libsupcs.Monitor.Exit(collection_mutex);
+            }
+
+            /* Allocations from per-cpu buffers don't take the mutex, so wait for them separately */
+            wait_for_alloc_buffers();
+            return true;
+        }
+
+        /** <summary>Grey everything referenced from the root blocks</summary> */
+        void grey_roots(mark_worker* w0)
+        {
+            root_header* cur_root_hdr = hdr->roots;
+            while(cur_root_hdr != null)
+            {
+                for(int i = 0; i < cur_root_hdr->size; i++)
+                {
+                    byte* root_start = *(byte**)((byte*)cur_root_hdr + sizeof(root_header) +
+                        i * 2 * sizeof(byte*));
+                    byte* root_end = *(byte**)((byte*)cur_root_hdr + sizeof(root_header) +
+                        (i * 2 + 1) * sizeof(byte*));
+
+                    grey_object(w0, root_start, root_end);
+
+#if GENGC_DEBUG
+                    Formatter.Write((ulong)root_start, "X", Program.arch.DebugOutput);
+                    Formatter.Write(" - ", Program.arch.DebugOutput);
+                    Formatter.Write((ulong)root_end, "X", Program.arch.DebugOutput);
+                    Formatter.WriteLine(Program.arch.DebugOutput);
+#endif
+                }
+                cur_root_hdr = cur_root_hdr->next;
+            }
+        }
+
+        /** <summary>Sweep one chunk if it is a large object: free it if it is white, or whiten
+         * and promote it if it is black.  Small object arrays are swept lazily.</summary> */
+        private void sweep_chunk(chunk_header* chk, bool minor)
+        {
+            int white_large = 0, black_large = 0;
+
+            if ((chk->flags & 0x30) == 0x10)
+            {
+                /* large object - is it white? */
+                if (minor && (chk->flags & 0x4) != 0)
+                {
+                    // old objects are not considered in a minor collection
+                }
+                else if ((chk->flags & 0x3) == 0x1)
+                {
+                    // TODO: delete large object
+                    // Can we do a tree node delete whilst traversal is in progress?
+                    white_large++;
+                }
+                else if((chk->flags & 0x3) == 0x2)
+                {
+                    // its black - set back to white and promote
+                    chk->flags &= ~0x3;
+                    chk->flags |= 0x1 | 0x4;
+                    black_large++;
+                }
+            }
+
+            /* The totals are shared with other sweepers */
+            if (white_large != 0)
+                System.Threading.Interlocked.Add(ref swept_white_large, white_large);
+            if (black_large != 0)
+                System.Threading.Interlocked.Add(ref swept_black_large, black_large);
+        }
+
+        private unsafe void grey_object(mark_worker* w, byte* obj_start, byte* obj_end)
         {
 #if GENGC_DEBUG
             Formatter.Write("gengc: greying object from ", Program.arch.DebugOutput);
@@ -371,6 +329,12 @@ namespace tysos.gc
             Formatter.WriteLine(Program.arch.DebugOutput);
 #endif
 
+            /* Neighbouring references often point into the same chunk, so remember the
+             * last one found to save a tree search */
+            chunk_header* last_chk = null;
+            byte* last_chk_start = null;
+            byte* last_chk_end = null;
+
             byte** cur_ptr = (byte**)obj_start;
             while((byte*)cur_ptr + sizeof(void*) <= obj_end)
             {
@@ -394,7 +358,19 @@ namespace tysos.gc
 #endif
 
                     /* Now get the chunk that contains it in the used tree */
-                    chunk_header* chk = search(hdr, 1, 1, obj);
+                    chunk_header* chk;
+                    if (obj >= last_chk_start && obj < last_chk_end)
+                        chk = last_chk;
+                    else
+                    {
+                        chk = find_chunk(obj);
+                        if (chk != null)
+                        {
+                            last_chk = chk;
+                            last_chk_start = (byte*)chk + sizeof(chunk_header);
+                            last_chk_end = last_chk_start + (int)chk->length;
+                        }
+                    }
 
                     if(chk != null)
                     {
@@ -407,10 +383,21 @@ namespace tysos.gc
                              * small object or something else (e.g. root pointer) */
                             if((chk->flags & 0x30) == 0x10)
                             {
-                                /* large object - we grey it if it is white */
-                                if((chk->flags & 0x3) == 0x1)
+                                /* large object - we grey it if it is white (and young, in
+                                 * a minor collection) */
+                                if (minor_in_progress && (chk->flags & 0x4) != 0)
+                                {
+                                }
+                                else if ((chk->flags & (1 << 6)) != 0)
                                 {
-                                    chk->flags |= 0x2;
+                                    /* no references - straight to black */
+                                    if (try_shade((uint*)&chk->flags, 0, 0x2))
+                                        w->marked_bytes += (long)chk->length;
+                                }
+                                else if (try_shade((uint*)&chk->flags, 0, 0x3))
+                                {
+                                    w->marked_bytes += (long)chk->length;
+                                    push_mark(w, chk_start, chk_end, (uint*)&chk->flags, 0);
                                 }
                             }
                             else if((chk->flags & 0x30) == 0x0)
@@ -420,7 +407,8 @@ namespace tysos.gc
                                 byte* data_start = (byte*)smhdr + sizeof(sma_header) +
                                     smhdr->total_count * 4;
 
-                                if (data_start > obj)
+                                if (data_start > obj ||
+                                    obj >= data_start + smhdr->total_count * smhdr->obj_length)
                                 {
 #if GENGC_DEBUG
                                     Formatter.Write("gengc: grey_object: object reference points to within sma_header, ignoring (obj: ", Program.arch.DebugOutput);
@@ -443,12 +431,26 @@ namespace tysos.gc
                                     uint* uint_ptr = (uint*)((byte*)smhdr + sizeof(sma_header) +
                                         uint_idx * 4);
 
-                                    uint flag_pattern = 0x3U << (bit_idx * 4);
-                                    uint white_pattern = 0x1U << (bit_idx * 4);
-                                    uint grey_pattern = 0x2U << (bit_idx * 4);
-
-                                    if ((*uint_ptr & flag_pattern) == white_pattern)
-                                        *uint_ptr |= grey_pattern;
+                                    /* The generation and noscan bits do not change whilst
+                                     * marking, but other markers may be changing the colours
+                                     * of neighbouring objects */
+                                    if (minor_in_progress && (*uint_ptr & (0x4U << (bit_idx * 4))) != 0)
+                                    {
+                                        /* old objects are not traced in a minor collection */
+                                    }
+                                    else if ((*uint_ptr & (0x8U << (bit_idx * 4))) != 0)
+                                    {
+                                        /* no references - straight to black */
+                                        if (try_shade(uint_ptr, bit_idx * 4, 0x2))
+                                            w->marked_bytes += smhdr->obj_length;
+                                    }
+                                    else if (try_shade(uint_ptr, bit_idx * 4, 0x3))
+                                    {
+                                        w->marked_bytes += smhdr->obj_length;
+                                        byte* sm_start = data_start + idx * smhdr->obj_length;
+                                        push_mark(w, sm_start, sm_start + smhdr->obj_length,
+                                            uint_ptr, bit_idx * 4);
+                                    }
                                 }
                             }
                         }
@@ -456,10 +458,147 @@ namespace tysos.gc
                     }
 
                 }
+                else if (obj >= los_start && obj < los_end)
+                    grey_los_object(w, obj);
 
                 //cur_ptr++;
                 cur_ptr = (byte**)(((byte*)cur_ptr) + 4);
             }
         }
+
+        private void allocate_mark_stack(mark_worker* w)
+        {
+            w->lock_obj = 0;
+            w->sp = 0;
+            w->size = 0;
+
+            chunk_header* chk = allocate_chunk(mark_stack_capacity * sizeof(mark_entry));
+            if (chk == null)
+            {
+                /* We can still collect, by scanning the heap for grey objects */
+                Formatter.WriteLine("gengc: unable to allocate mark stack", Program.arch.DebugOutput);
+                return;
+            }
+            chk->flags &= ~(1 << 4);        // not large block
+            chk->flags |= 1 << 5;           // not a small object array either
+
+            w->stack = (mark_entry*)((byte*)chk + sizeof(chunk_header));
+            w->size = mark_stack_capacity;
+        }
+
+        private void push_mark(mark_worker* w, byte* obj_start, byte* obj_end, uint* colour, int shift)
+        {
+            lock_worker(w);
+            if (w->sp == w->size)
+            {
+                unlock_worker(w);
+                mark_overflow = true;
+                return;
+            }
+
+            mark_entry* e = &w->stack[w->sp++];
+            e->start = obj_start;
+            e->end = obj_end;
+            e->colour = colour;
+            e->shift = shift;
+            unlock_worker(w);
+        }
+
+        /** <summary>Scan and blacken objects on a worker's mark stack until it is empty.  Returns
+         * the number of objects blackened</summary> */
+        private int drain_mark_stack(mark_worker* w)
+        {
+            return drain_mark_stack(w, 0);
+        }
+
+        /** <summary>As drain_mark_stack, but give up once the timer passes deadline (unless it
+         * is zero), leaving the remaining entries on the stack</summary> */
+        private int drain_mark_stack(mark_worker* w, long deadline)
+        {
+            int count = 0;
+            while (true)
+            {
+                if (deadline != 0 && (count & 0x3f) == 0x3f && Program.arch.GetNow() >= deadline)
+                    break;
+
+                /* Copy the entry out as grey_object may push over it */
+                lock_worker(w);
+                if (w->sp == 0)
+                {
+                    unlock_worker(w);
+                    break;
+                }
+                mark_entry e = w->stack[--w->sp];
+                unlock_worker(w);
+
+                grey_object(w, e.start, e.end);
+
+                /* grey (11) to black (10) */
+                atomic_and(e.colour, ~(0x1U << e.shift));
+                count++;
+            }
+            return count;
+        }
+
+        /** <summary>Iterate through all blocks, scanning and blackening any grey objects.  Used
+         * after the mark stack has overflowed.  Returns the number of objects blackened</summary> */
+        private int scan_grey_objects(mark_worker* w)
+        {
+            int count = 0;
+
+            chunk_header* chk = hdr->root_used_chunk;
+            while (chk->left != hdr->nil)
+                chk = chk->left;
+
+            while (chk != hdr->nil)
+            {
+                if ((chk->flags & 0x30) == 0x10)
+                {
+                    /* large object - is it grey? */
+                    if ((chk->flags & 0x3) == 0x3)
+                    {
+                        byte* obj_start = (byte*)chk + sizeof(chunk_header);
+                        byte* obj_end = obj_start + (int)chk->length;
+
+                        grey_object(w, obj_start, obj_end);
+                        chk->flags &= ~0x1;
+                        count++;
+                    }
+                }
+                else if ((chk->flags & 0x30) == 0x0)
+                {
+                    /* small object array, iterate through each */
+                    sma_header* smhdr = (sma_header*)((byte*)chk + sizeof(chunk_header));
+                    byte* data_start = (byte*)smhdr + sizeof(sma_header) +
+                        smhdr->total_count * 4;
+
+                    for (int i = 0; i < smhdr->total_count; i += 8)
+                    {
+                        uint* uint_ptr = (uint*)((byte*)smhdr + sizeof(sma_header) +
+                            i / 2);
+
+                        for (int bit_idx = 0; bit_idx < 8; bit_idx++)
+                        {
+                            uint flag_pattern = 0x3U << (bit_idx * 4);
+
+                            if ((*uint_ptr & flag_pattern) == flag_pattern)
+                            {
+                                byte* obj_start = data_start + (i + bit_idx) *
+                                    smhdr->obj_length;
+
+                                grey_object(w, obj_start, obj_start + smhdr->obj_length);
+                                *uint_ptr &= ~(0x1U << (bit_idx * 4));
+                                count++;
+                            }
+                        }
+                    }
+                }
+
+                chk = TreeSuccessor(hdr, 1, chk);
+            }
+
+            count += scan_grey_los(w);
+            return count;
+        }
     }
 }
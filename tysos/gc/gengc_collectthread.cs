@@ -23,46 +23,54 @@ namespace tysos.gc
 {
     unsafe partial class gengc
     {
-        static int max_allocs = 10000;
-        const int min_allocs = 100;
-
         public static bool ScheduleCollection { get; set; } = false;
 
-        /* Runs at high priority and ensures a collection occurs when
-        allocs >= max_allocs */
-        public static void MaxAllocCollectThreadProc()
+        /* Runs at high priority and ensures a collection occurs when the bytes
+        allocated reach the trigger (see gengc_trigger.cs) */
+        public static void AllocTriggerCollectThreadProc()
         {
             while (heap == null) ;
             while (true)
             {
                 tysos.Syscalls.SchedulerFunctions.Block(new DelegateEvent(
-                    delegate () { return heap.allocs >= max_allocs; }));
+                    delegate () { return heap.collection_due(); }));
                 var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
-                System.Diagnostics.Debugger.Log(0, "gengc", "performing collection due to high number of allocations (" + heap.allocs.ToString() + ")");
-                heap.DoCollection();
-                System.Diagnostics.Debugger.Log(0, "gengc", "max_alloc collection done");
-
-                max_allocs += max_allocs / 2;
-                if (max_allocs >= 1000000) max_allocs = 1000000;
-
+                System.Diagnostics.Debugger.Log(0, "gengc", "performing collection after allocating " + heap.allocated_bytes.ToString() + " bytes");
+                heap.Collect();
+                System.Diagnostics.Debugger.Log(0, "gengc", "triggered collection done");
                 libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                RunIncrementalSteps();
             }
         }
 
-        /* Runs at low priority and runs a background collection only when
-        allocs >= min_allocs */
-        public static void MinAllocCollectThreadProc()
+        /* Runs at idle priority and runs an opportunistic background collection
+        when one is worthwhile */
+        public static void IdleCollectThreadProc()
         {
             while (heap == null) ;
             while (true)
             {
                 tysos.Syscalls.SchedulerFunctions.Block(new DelegateEvent(
-                    delegate () { return heap.allocs >= min_allocs; }));
+                    delegate () { return heap.idle_collection_due(); }));
                 var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
-                System.Diagnostics.Debugger.Log(0, "gengc", "performing background collection due to low number of allocations (" + heap.allocs.ToString() + ")");
-                heap.DoCollection();
-                System.Diagnostics.Debugger.Log(0, "gengc", "min_alloc collection done");
+                System.Diagnostics.Debugger.Log(0, "gengc", "performing idle collection after allocating " + heap.allocated_bytes.ToString() + " bytes");
+                heap.Collect();
+                System.Diagnostics.Debugger.Log(0, "gengc", "idle collection done");
                 libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                RunIncrementalSteps();
+            }
+        }
+
+        /* Runs at low priority and sweeps the small object arrays left over from the
+         * last collection, so that the allocator rarely has to */
+        public static void LazySweepThreadProc()
+        {
+            while (heap == null) ;
+            while (true)
+            {
+                tysos.Syscalls.SchedulerFunctions.Block(new DelegateEvent(
+                    delegate () { return heap.lazy_sweep_cursor != null; }));
+                while (heap.lazy_sweep_step()) ;
             }
         }
 
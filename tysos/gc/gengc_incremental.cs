@@ -0,0 +1,134 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Incremental collections for gengc
+ * 
+ * A full collection normally runs to completion with allocation stopped.  If
+ * IncrementalCollections is set, its marking is instead split into steps which each
+ * stop allocation for at most IncrementalPauseBudget ns, and the mutator runs in between.
+ * 
+ * The first step greys the roots.  Each later step pops objects from the mark stack until
+ * it is empty or the budget is used up.  Once it is empty, the final step greys the roots
+ * again (stores to them do not go through the write barrier), marks anything which is
+ * still grey and then sweeps.
+ * 
+ * Whilst marking, the mutator must not hide a white object by storing the only reference
+ * to it in an object which has already been blackened.  gcwritebarrier therefore shades
+ * whatever is stored to a heap slot (an insertion barrier), and new objects are allocated
+ * black.  As with minor collections, this relies on the barrier being emitted for every
+ * reference store.
+ * 
+ * The final step only sweeps large objects: small object arrays are swept lazily, as
+ * after any other collection.
+ */
+
+namespace tysos.gc
+{
+    unsafe partial class gengc
+    {
+        /** <summary>Set if all reference stores to the heap call gcwritebarrier, allowing
+         * full collections to be run in steps</summary> */
+        public static bool IncrementalCollections = false;
+
+        /** <summary>The longest time, in ns, that a step of an incremental collection should
+         * stop allocation for</summary> */
+        public static long IncrementalPauseBudget = 1000000;
+
+        /** <summary>The time, in ns, that other threads are given to run between steps</summary> */
+        public static long IncrementalStepInterval = 2000000;
+
+        bool incremental_marking = false;
+        uint alloc_colour = 0x1;            // white, or black whilst marking incrementally
+
+        /** <summary>Run the next step of an incremental collection, starting one if none is
+         * running.  A budget of zero runs the marking to completion.  Returns true once the
+         * collection has finished</summary> */
+        bool incremental_step(long budget)
+        {
+            long deadline = 0;
+            if (budget > 0)
+                deadline = Program.arch.GetNow() + budget / 100;
+
+            if (begin_collection() == false)
+                return false;
+
+            mark_worker* w0 = get_mark_worker(0);
+
+            if (incremental_marking == false)
+            {
+                /* Anything allocated from now on survives this collection */
+                finish_lazy_sweep();
+                reset_marked_bytes();
+                minor_in_progress = false;
+                incremental_marking = true;
+                alloc_colour = 0x2;
+
+                grey_roots(w0);
+                collection_in_progress = false;
+                return false;
+            }
+
+            if (w0->sp != 0 || mark_overflow)
+            {
+                drain_mark_stack(w0, deadline);
+                if (w0->sp == 0 && mark_overflow)
+                {
+                    mark_overflow = false;
+                    scan_grey_objects(w0);
+                }
+                collection_in_progress = false;
+                return false;
+            }
+
+            grey_roots(w0);
+            finish_collection(false);
+            return true;
+        }
+
+        /** <summary>The write barrier whilst marking: grey whatever slot now refers to</summary> */
+        void shade_slot(void* slot)
+        {
+            /* grey_object searches the used tree, so keep allocations out */
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            acquire_alloc();
+            if (incremental_marking)
+                grey_object(get_mark_worker(0), (byte*)slot, (byte*)slot + sizeof(void*));
+            alloc_in_progress = false;
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+        }
+
+        /** <summary>Run the remaining steps of an incremental collection started by
+         * Collect(), sleeping between them</summary> */
+        internal static void RunIncrementalSteps()
+        {
+            while (heap.incremental_marking)
+            {
+                tysos.Syscalls.SchedulerFunctions.Sleep(IncrementalStepInterval);
+
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+                if (heap.incremental_marking)
+                    heap.incremental_step(IncrementalPauseBudget);
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            }
+        }
+    }
+}
@@ -0,0 +1,308 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#if !NET6_0_OR_GREATER
+#if _WIN32
+    using nuint = System.UInt32;
+#else
+    using nuint = System.UInt64;
+#endif
+#endif
+
+/* Large object space for gengc
+ * 
+ * Chunks are never returned to the free tree, so a large object allocated from one holds
+ * its memory for ever.  Objects of at least los_min_pages pages are instead given their own
+ * run of pages, mapped on allocation and unmapped (with the physical pages released) when
+ * the object is found to be dead.
+ * 
+ * The space is reserved at the top of the heap's address range, above the page and card
+ * tables.  The first span holds the metadata.  Each following span serves one size class,
+ * with slots of (los_min_pages << class) pages, so the slot holding an address can be
+ * found arithmetically.  Slots are only ever mapped for the pages an object needs.
+ * 
+ * Each slot has a descriptor whose flags are laid out as a chunk_header's (colour, old,
+ * large and noscan bits) with los_in_use and los_dirty added.  Cards only cover the chunk
+ * heap, so the write barrier sets los_dirty instead for stores to old large objects.
+ */
+
+namespace tysos.gc
+{
+    unsafe partial class gengc
+    {
+        struct los_slot
+        {
+            public int flags;
+            public int pages;           // pages mapped for the object
+        }
+
+        struct los_class
+        {
+            public byte* base_addr;     // address of slot 0
+            public int shift;           // log2 of the slot size
+            public int capacity;
+            public int high_water;      // slots from here on have never been used
+            public int free_sp;
+            public los_slot* slots;
+            public int* free_stack;
+        }
+
+        const int los_min_pages = 4;
+        const int los_classes = 16;
+        const int los_in_use = 1 << 7;
+        const int los_dirty = 1 << 8;
+
+        los_class* los = null;
+        byte* los_start = null;         // first object slot
+        byte* los_end = null;
+        ulong los_span = 0;
+
+        /** <summary>Reserve the large object space at the top of [start, end).  Returns the
+         * new end of the space available</summary> */
+        void* init_los(void* start, void* end)
+        {
+            ulong area = ((ulong)((byte*)end - (byte*)start) / 4) & ~0xfffUL;
+            los_span = (area / (los_classes + 1)) & ~0xfffUL;
+
+            byte* meta = (byte*)end - (long)(los_span * (los_classes + 1));
+            los = (los_class*)meta;
+            los_start = meta + los_span;
+            los_end = los_start + (long)(los_span * los_classes);
+
+            byte* meta_ptr = meta + util.align((ulong)(los_classes * sizeof(los_class)), 16);
+            for (int c = 0; c < los_classes; c++)
+            {
+                los_class* lc = &los[c];
+                lc->base_addr = los_start + (long)(los_span * (ulong)c);
+                lc->shift = 14 + c;         // log2(los_min_pages * 0x1000) + c
+                ulong capacity = los_span >> lc->shift;
+                lc->capacity = capacity > int.MaxValue ? int.MaxValue : (int)capacity;
+                lc->high_water = 0;
+                lc->free_sp = 0;
+
+                lc->slots = (los_slot*)meta_ptr;
+                meta_ptr += (long)lc->capacity * sizeof(los_slot);
+                lc->free_stack = (int*)meta_ptr;
+                meta_ptr += (long)lc->capacity * sizeof(int);
+            }
+
+            if (meta_ptr > los_start)
+                throw new System.Exception("Not enough space for large object space metadata");
+
+            return meta;
+        }
+
+        /** <summary>Allocate an object from the large object space.  Returns null if it is too
+         * big, its class is full or paging is not yet available, in which case the caller
+         * falls back to a chunk.  Called with the allocation lock held</summary> */
+        void* los_alloc(int length, bool noscan)
+        {
+            var vmem = Program.arch.VirtMem;
+            if (vmem == null || los == null)
+                return null;
+
+            int pages = (int)(((ulong)length + 0xfff) >> 12);
+            int c = 0;
+            while (c < los_classes && (los_min_pages << c) < pages)
+                c++;
+            if (c == los_classes)
+                return null;
+
+            los_class* lc = &los[c];
+            int slot;
+            if (lc->free_sp > 0)
+                slot = lc->free_stack[--lc->free_sp];
+            else if (lc->high_water < lc->capacity)
+                slot = lc->high_water++;
+            else
+                return null;
+
+            byte* va = lc->base_addr + ((long)slot << lc->shift);
+            vmem.Map(0, (nuint)pages << 12, (nuint)va, VirtMem.FLAG_allocate | VirtMem.FLAG_writeable);
+
+            los_slot* s = &lc->slots[slot];
+            s->pages = pages;
+            s->flags = los_in_use | 0x10 | (int)alloc_colour | (noscan ? 1 << 6 : 0);
+            return va;
+        }
+
+        /** <summary>Get the descriptor of the object containing addr, which must lie within
+         * [los_start, los_end), or null if there is none</summary> */
+        los_slot* find_los_slot(byte* addr, out byte* obj_start)
+        {
+            obj_start = null;
+
+            ulong offset = (ulong)(addr - los_start);
+            int c = (int)(offset / los_span);
+            los_class* lc = &los[c];
+            long slot = (long)((offset - los_span * (ulong)c) >> lc->shift);
+            if (slot >= lc->high_water)
+                return null;
+
+            los_slot* s = &lc->slots[slot];
+            if ((s->flags & los_in_use) == 0)
+                return null;
+
+            byte* start = lc->base_addr + (slot << lc->shift);
+            if (addr >= start + ((long)s->pages << 12))
+                return null;
+
+            obj_start = start;
+            return s;
+        }
+
+        /** <summary>Grey the large object containing obj, as grey_object does for chunks</summary> */
+        void grey_los_object(mark_worker* w, byte* obj)
+        {
+            byte* obj_start;
+            los_slot* s = find_los_slot(obj, out obj_start);
+            if (s == null)
+                return;
+
+            if (minor_in_progress && (s->flags & 0x4) != 0)
+            {
+                /* old objects are not traced in a minor collection */
+            }
+            else if ((s->flags & (1 << 6)) != 0)
+            {
+                if (try_shade((uint*)&s->flags, 0, 0x2))
+                    w->marked_bytes += (long)s->pages << 12;
+            }
+            else if (try_shade((uint*)&s->flags, 0, 0x3))
+            {
+                w->marked_bytes += (long)s->pages << 12;
+                push_mark(w, obj_start, obj_start + ((long)s->pages << 12), (uint*)&s->flags, 0);
+            }
+        }
+
+        /** <summary>Record a reference store into a large object</summary> */
+        void los_write_barrier(void* slot)
+        {
+            byte* obj_start;
+            los_slot* s = find_los_slot((byte*)slot, out obj_start);
+            if (s != null && (s->flags & los_dirty) == 0)
+                atomic_or((uint*)&s->flags, los_dirty);
+        }
+
+        /** <summary>For a minor collection, grey any young objects referenced from dirty old
+         * large objects, cleaning them</summary> */
+        void scan_dirty_los(mark_worker* w)
+        {
+            for (int c = 0; c < los_classes; c++)
+            {
+                los_class* lc = &los[c];
+                for (int i = 0; i < lc->high_water; i++)
+                {
+                    los_slot* s = &lc->slots[i];
+                    if ((s->flags & (los_in_use | los_dirty)) != (los_in_use | los_dirty))
+                        continue;
+                    atomic_and((uint*)&s->flags, ~(uint)los_dirty);
+
+                    if ((s->flags & 0x4) != 0 && (s->flags & (1 << 6)) == 0)
+                    {
+                        byte* obj_start = lc->base_addr + ((long)i << lc->shift);
+                        grey_object(w, obj_start, obj_start + ((long)s->pages << 12));
+                    }
+                }
+            }
+        }
+
+        /** <summary>Scan and blacken grey large objects after the mark stack has overflowed.
+         * Returns the number of objects blackened</summary> */
+        int scan_grey_los(mark_worker* w)
+        {
+            int count = 0;
+            for (int c = 0; c < los_classes; c++)
+            {
+                los_class* lc = &los[c];
+                for (int i = 0; i < lc->high_water; i++)
+                {
+                    los_slot* s = &lc->slots[i];
+                    if ((s->flags & (los_in_use | 0x3)) != (los_in_use | 0x3))
+                        continue;
+
+                    byte* obj_start = lc->base_addr + ((long)i << lc->shift);
+                    grey_object(w, obj_start, obj_start + ((long)s->pages << 12));
+                    atomic_and((uint*)&s->flags, ~0x1U);
+                    count++;
+                }
+            }
+            return count;
+        }
+
+        /** <summary>Unmap white large objects, releasing their pages, and whiten and promote
+         * black ones.  A minor collection leaves old objects alone</summary> */
+        void sweep_los(bool minor)
+        {
+            if (los == null)
+                return;
+
+            int white_large = 0, black_large = 0;
+            for (int c = 0; c < los_classes; c++)
+            {
+                los_class* lc = &los[c];
+                for (int i = 0; i < lc->high_water; i++)
+                {
+                    los_slot* s = &lc->slots[i];
+                    if ((s->flags & los_in_use) == 0)
+                        continue;
+
+                    if (minor && (s->flags & 0x4) != 0)
+                    {
+                    }
+                    else if ((s->flags & 0x3) == 0x1)
+                    {
+                        release_los_pages(lc->base_addr + ((long)i << lc->shift), s->pages);
+                        s->flags = 0;
+                        s->pages = 0;
+                        lc->free_stack[lc->free_sp++] = i;
+                        white_large++;
+                    }
+                    else if ((s->flags & 0x3) == 0x2)
+                    {
+                        /* The write barrier may be setting los_dirty.  Survivors of a full
+                         * collection have no old to young references, as with clear_cards() */
+                        atomic_and((uint*)&s->flags, minor ? ~0x3U : ~(0x3U | los_dirty));
+                        atomic_or((uint*)&s->flags, 0x1 | 0x4);
+                        black_large++;
+                    }
+                }
+            }
+
+            swept_white_large += white_large;
+            swept_black_large += black_large;
+        }
+
+        void release_los_pages(byte* va, int pages)
+        {
+            var vmem = Program.arch.VirtMem;
+            var pmem = Program.arch.PhysMem;
+
+            for (int i = 0; i < pages; i++)
+            {
+                nuint paddr = vmem.Unmap((nuint)(va + ((long)i << 12)));
+                if (paddr != 0 && pmem != null)
+                    pmem.ReleaseMapped(paddr);
+            }
+        }
+    }
+}
@@ -0,0 +1,97 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Page table for gengc
+ * 
+ * Resolving a pointer found whilst marking to the chunk containing it used to need a
+ * search of the used tree.  Instead, each page of the heap has an entry pointing to the
+ * lowest addressed used chunk which overlaps it.  Most pages are covered by a single
+ * chunk, so the entry is the answer.  On pages where one chunk ends and another starts,
+ * the following chunks are found with TreeSuccessor.
+ * 
+ * Used chunks are never returned to the free tree, so entries only change when a chunk
+ * is allocated.  Like the card table, the page table lives at the top of the heap's
+ * address range and is only touched below heap_top.
+ */
+
+namespace tysos.gc
+{
+    unsafe partial class gengc
+    {
+        const int page_table_shift = 12;
+
+        chunk_header** page_table = null;
+
+        /** <summary>Reserve the page table at the top of [start, end).  Returns the new end
+         * of the space available</summary> */
+        void* init_page_table(void* start, void* end)
+        {
+            ulong page_count = (ulong)((byte*)end - (byte*)start) >> page_table_shift;
+            ulong table_length = util.align(page_count * (ulong)sizeof(chunk_header*), 0x1000);
+
+            page_table = (chunk_header**)((byte*)end - table_length);
+            return page_table;
+        }
+
+        /** <summary>Clear the entries for pages which start in [from, to), which are about to
+         * be used for the first time</summary> */
+        void clear_page_entries(byte* from, byte* to)
+        {
+            long first = (from - (byte*)heap_start + (1 << page_table_shift) - 1) >> page_table_shift;
+            long last = (to - (byte*)heap_start + (1 << page_table_shift) - 1) >> page_table_shift;
+            if (last > first)
+                libsupcs.MemoryOperations.MemSet(&page_table[first], 0, (int)((last - first) * sizeof(chunk_header*)));
+        }
+
+        /** <summary>Record a newly allocated chunk against the pages it covers</summary> */
+        void map_chunk_pages(chunk_header* chk)
+        {
+            byte* chk_end = (byte*)chk + sizeof(chunk_header) + (int)chk->length;
+            long first = ((byte*)chk - (byte*)heap_start) >> page_table_shift;
+            long last = (chk_end - 1 - (byte*)heap_start) >> page_table_shift;
+
+            for (long i = first; i <= last; i++)
+            {
+                if (page_table[i] == null || page_table[i] > chk)
+                    page_table[i] = chk;
+            }
+        }
+
+        /** <summary>Find the used chunk whose data contains addr, or null if there is none</summary> */
+        chunk_header* find_chunk(byte* addr)
+        {
+            if (addr < (byte*)heap_start || addr >= heap_top)
+                return null;
+
+            chunk_header* chk = page_table[(addr - (byte*)heap_start) >> page_table_shift];
+            while (chk != null && chk != hdr->nil && (byte*)chk < addr)
+            {
+                byte* chk_start = (byte*)chk + sizeof(chunk_header);
+                if (addr < chk_start + (int)chk->length)
+                    return (addr >= chk_start) ? chk : null;
+
+                chk = TreeSuccessor(hdr, 1, chk);
+            }
+            return null;
+        }
+    }
+}
@@ -0,0 +1,422 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Parallel marking and sweeping for gengc
+ * 
+ * The thread which runs DoCollection (the coordinator) scans the roots itself and then
+ * opens a mark phase followed by a sweep phase.  On a multi-processor system each cpu
+ * has a gc_worker thread which waits on phase_event and joins any phase which is open.
+ * The coordinator never waits for workers to arrive, so if there is only one cpu, or
+ * the workers are slow to be scheduled, it simply does all of the work itself.
+ * 
+ * Marking:  each participant has its own mark stack.  Objects are greyed with an atomic
+ * update of their colour bits so that exactly one marker pushes each of them.  A
+ * participant which runs out of work steals half of the entries on another's stack.
+ * The phase ends once every participant is idle.  Only a participant with work pushes
+ * on to its own stack, so at that point every stack is empty.
+ * 
+ * Sweeping:  participants claim chunks one at a time from a shared cursor, so each
+ * chunk is swept by exactly one of them.  Sweeping does not change the used tree, so
+ * the cursor can be advanced whilst other chunks are being swept.
+ */
+
+namespace tysos.gc
+{
+    unsafe partial class gengc
+    {
+        struct mark_worker
+        {
+            public int lock_obj;        // protects sp and the stack contents
+            public int sp;
+            public int size;
+            public mark_entry* stack;
+            public long marked_bytes;   // size of the objects this worker has shaded
+        }
+
+        const int max_mark_workers = 16;
+        mark_worker* mark_workers = null;
+        int mark_worker_count = 1;          // worker 0 belongs to the coordinator
+
+        const int PHASE_NONE = 0;
+        const int PHASE_MARK = 1;
+        const int PHASE_SWEEP = 2;
+
+        /* Phase state, changed under phase_lock */
+        int phase_lock = 0;
+        int phase = PHASE_NONE;
+        int phase_generation = 0;
+        int phase_participants = 0;
+        int phase_active = 0;               // participants which have not yet left the phase
+        int phase_idle = 0;
+        int phase_marked = 0;
+
+        static Event phase_event = null;
+
+        bool sweep_minor = false;
+        chunk_header* sweep_cursor = null;
+        int sweep_count = 0;
+        int swept_white_large, swept_white_small, swept_black_large, swept_black_small;
+
+        mark_worker* get_mark_worker(int idx)
+        {
+            return &mark_workers[idx];
+        }
+
+        private void allocate_mark_workers()
+        {
+            chunk_header* chk = allocate_chunk(max_mark_workers * sizeof(mark_worker));
+            if (chk == null)
+            {
+                Formatter.WriteLine("gengc: allocate_mark_workers: allocate_chunk() returned null",
+                    Program.arch.DebugOutput);
+                libsupcs.OtherOperations.Halt();
+            }
+            chk->flags &= ~(1 << 4);        // not large block
+            chk->flags |= 1 << 5;           // not a small object array either
+
+            mark_workers = (mark_worker*)((byte*)chk + sizeof(chunk_header));
+            for (int i = 0; i < max_mark_workers; i++)
+            {
+                mark_workers[i].lock_obj = 0;
+                mark_workers[i].sp = 0;
+                mark_workers[i].size = 0;
+                mark_workers[i].stack = null;
+            }
+
+            allocate_mark_stack(get_mark_worker(0));
+        }
+
+        /** <summary>Allocate a mark stack for a new worker thread, or return null if there
+         * are already enough</summary> */
+        mark_worker* register_mark_worker()
+        {
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            acquire_alloc();
+
+            mark_worker* w = null;
+            if (mark_worker_count < max_mark_workers)
+            {
+                w = get_mark_worker(mark_worker_count);
+                allocate_mark_stack(w);
+                mark_worker_count++;
+            }
+
+            alloc_in_progress = false;
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return w;
+        }
+
+        static void lock_worker(mark_worker* w)
+        {
+            while (System.Threading.Interlocked.CompareExchange(ref w->lock_obj, 1, 0) != 0) ;
+        }
+
+        static void unlock_worker(mark_worker* w)
+        {
+            w->lock_obj = 0;
+        }
+
+        void lock_phase()
+        {
+            while (System.Threading.Interlocked.CompareExchange(ref phase_lock, 1, 0) != 0) ;
+        }
+
+        void unlock_phase()
+        {
+            phase_lock = 0;
+        }
+
+        /** <summary>Atomically change a white object's colour bits to colour.  Returns false
+         * if it was not white (e.g. another marker got there first)</summary> */
+        static bool try_shade(uint* word, int shift, uint colour)
+        {
+            while (true)
+            {
+                uint ov = *word;
+                if (((ov >> shift) & 0x3U) != 0x1U)
+                    return false;
+                uint nv = (ov & ~(0x3U << shift)) | (colour << shift);
+                if ((uint)System.Threading.Interlocked.CompareExchange(ref *(int*)word, (int)nv, (int)ov) == ov)
+                    return true;
+            }
+        }
+
+        static void atomic_and(uint* word, uint mask)
+        {
+            while (true)
+            {
+                uint ov = *word;
+                if ((uint)System.Threading.Interlocked.CompareExchange(ref *(int*)word, (int)(ov & mask), (int)ov) == ov)
+                    return;
+            }
+        }
+
+        static void atomic_or(uint* word, uint bits)
+        {
+            while (true)
+            {
+                uint ov = *word;
+                if ((uint)System.Threading.Interlocked.CompareExchange(ref *(int*)word, (int)(ov | bits), (int)ov) == ov)
+                    return;
+            }
+        }
+
+        /** <summary>Open a phase, with the coordinator as its only participant</summary> */
+        void open_phase(int new_phase)
+        {
+            lock_phase();
+            phase = new_phase;
+            phase_generation++;
+            phase_participants = 1;
+            phase_active = 1;
+            phase_idle = 0;
+            phase_marked = 0;
+            unlock_phase();
+
+            if (phase_event != null)
+                phase_event.Set();
+        }
+
+        /** <summary>Stop further workers joining the current phase, and wait for those which
+         * have to leave it</summary> */
+        void close_phase()
+        {
+            lock_phase();
+            phase = PHASE_NONE;
+            unlock_phase();
+
+            if (phase_event != null)
+                phase_event.Reset();
+
+            System.Threading.Interlocked.Add(ref phase_active, -1);
+            while (System.Threading.Interlocked.CompareExchange(ref phase_active, 0, 0) != 0) ;
+        }
+
+        /** <summary>Join the open phase, if there is one which this worker has not yet taken
+         * part in.  Returns the phase joined</summary> */
+        int join_phase(ref int seen_generation)
+        {
+            int ret = PHASE_NONE;
+            lock_phase();
+            if (phase != PHASE_NONE && phase_generation != seen_generation)
+            {
+                seen_generation = phase_generation;
+                phase_participants++;
+                phase_active++;
+                ret = phase;
+            }
+            unlock_phase();
+            return ret;
+        }
+
+        void leave_phase()
+        {
+            System.Threading.Interlocked.Add(ref phase_active, -1);
+        }
+
+        /** <summary>Run a mark phase, returning the number of objects blackened by all
+         * participants</summary> */
+        int parallel_mark()
+        {
+            open_phase(PHASE_MARK);
+            mark_loop(get_mark_worker(0));
+            close_phase();
+            return phase_marked;
+        }
+
+        void mark_loop(mark_worker* w)
+        {
+            int count = 0;
+
+            while (true)
+            {
+                count += drain_mark_stack(w);
+                if (steal_marks(w))
+                    continue;
+
+                /* Out of work - wait for some to appear, or for everyone to finish */
+                System.Threading.Interlocked.Add(ref phase_idle, 1);
+                bool done = false;
+                while (true)
+                {
+                    lock_phase();
+                    done = phase_idle == phase_participants;
+                    unlock_phase();
+                    if (done)
+                        break;
+
+                    if (marks_available())
+                    {
+                        System.Threading.Interlocked.Add(ref phase_idle, -1);
+                        break;
+                    }
+                }
+                if (done)
+                    break;
+            }
+
+            System.Threading.Interlocked.Add(ref phase_marked, count);
+        }
+
+        bool marks_available()
+        {
+            for (int i = 0; i < mark_worker_count; i++)
+            {
+                if (mark_workers[i].sp != 0)
+                    return true;
+            }
+            return false;
+        }
+
+        /** <summary>Move half of the entries from the fullest other mark stack to ours, which
+         * must be empty</summary> */
+        bool steal_marks(mark_worker* w)
+        {
+            mark_worker* victim = null;
+            int victim_sp = 0;
+            for (int i = 0; i < mark_worker_count; i++)
+            {
+                mark_worker* v = get_mark_worker(i);
+                if (v != w && v->sp > victim_sp)
+                {
+                    victim = v;
+                    victim_sp = v->sp;
+                }
+            }
+            if (victim == null)
+                return false;
+
+            /* Always lock in address order so that two thieves cannot deadlock */
+            if (victim < w)
+            {
+                lock_worker(victim);
+                lock_worker(w);
+            }
+            else
+            {
+                lock_worker(w);
+                lock_worker(victim);
+            }
+
+            int n = (victim->sp + 1) / 2;
+            if (n > w->size - w->sp)
+                n = w->size - w->sp;
+            for (int i = 0; i < n; i++)
+                w->stack[w->sp++] = victim->stack[--victim->sp];
+
+            unlock_worker(victim);
+            unlock_worker(w);
+            return n > 0;
+        }
+
+        /** <summary>Run a sweep phase.  Returns the number of chunks swept</summary> */
+        int parallel_sweep(bool minor)
+        {
+            swept_white_large = 0;
+            swept_white_small = 0;
+            swept_black_large = 0;
+            swept_black_small = 0;
+
+            sweep_minor = minor;
+            sweep_count = 0;
+            sweep_cursor = hdr->root_used_chunk;
+            while (sweep_cursor->left != hdr->nil)
+                sweep_cursor = sweep_cursor->left;
+
+            open_phase(PHASE_SWEEP);
+            sweep_loop();
+            close_phase();
+
+            return sweep_count;
+        }
+
+        void sweep_loop()
+        {
+            while (true)
+            {
+                lock_phase();
+                chunk_header* chk = sweep_cursor;
+                if (chk != hdr->nil)
+                {
+                    sweep_cursor = TreeSuccessor(hdr, 1, chk);
+                    sweep_count++;
+                }
+                unlock_phase();
+
+                if (chk == hdr->nil)
+                    return;
+                sweep_chunk(chk, sweep_minor);
+            }
+        }
+
+        /** <summary>Create a worker thread on each cpu to help with collections.  Does
+         * nothing on a uni-processor system</summary> */
+        public static void StartMarkWorkers()
+        {
+            if (Program.arch.Processors.Count < 2)
+                return;
+
+            phase_event = new Event();
+            foreach (Cpu cpu in Program.arch.Processors)
+            {
+                Thread t = Thread.Create("gc_worker", new System.Threading.ThreadStart(MarkWorkerThreadProc),
+                    new object[] { });
+                t.priority = 10;
+                t.affinity = cpu;
+                cpu.CurrentScheduler.Reschedule(t);
+            }
+        }
+
+        /* Joins in with the mark and sweep phases of collections run on other cpus */
+        static void MarkWorkerThreadProc()
+        {
+            while (heap == null) ;
+            mark_worker* w = heap.register_mark_worker();
+            if (w == null)
+                return;
+
+            int seen_generation = 0;
+            while (true)
+            {
+                tysos.Syscalls.SchedulerFunctions.Block(phase_event);
+
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+                switch (heap.join_phase(ref seen_generation))
+                {
+                    case PHASE_MARK:
+                        heap.mark_loop(w);
+                        heap.leave_phase();
+                        break;
+                    case PHASE_SWEEP:
+                        heap.sweep_loop();
+                        heap.leave_phase();
+                        break;
+                }
+
+                /* Don't spin on phase_event whilst the phase we have finished with is
+                 * still open */
+                while (heap.phase != PHASE_NONE && heap.phase_generation == seen_generation) ;
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            }
+        }
+    }
+}
@@ -0,0 +1,210 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Lazy sweeping of small object arrays for gengc
+ * 
+ * Once marking has finished, every small object array needs sweeping: white objects are
+ * freed and black ones whitened and promoted.  Rather than doing this for the whole heap
+ * before the collection returns, the collection just increments mark_epoch.  An array
+ * whose sweep_epoch differs from it is pending, and is swept by whichever of these gets
+ * to it first:
+ * 
+ * - the allocator, before it takes an object from the array, so that nothing is ever
+ *      allocated among colours left over from the last mark
+ * - the low priority gc_sweep thread, which works through the shared arrays in turn
+ * - the next collection, before it starts marking
+ * 
+ * An array owned by a cpu's allocation buffer is only swept by that cpu or by a
+ * collection.  Shared arrays are only swept with alloc_in_progress or
+ * collection_in_progress set.
+ */
+
+namespace tysos.gc
+{
+    unsafe partial class gengc
+    {
+        int mark_epoch = 0;
+        bool lazy_sweep_minor = false;              // are the pending sweeps for a minor collection?
+        int lazy_sweep_pending = 0;                 // arrays not yet swept since the last mark
+        chunk_header* lazy_sweep_cursor = null;     // where gc_sweep has got to, or null if done
+        int sma_count = 0;
+
+        /** <summary>Make every small object array pending, once marking has finished</summary> */
+        void begin_lazy_sweep(bool minor)
+        {
+            mark_epoch++;
+            lazy_sweep_minor = minor;
+            lazy_sweep_pending = sma_count;
+
+            chunk_header* chk = hdr->root_used_chunk;
+            while (chk->left != hdr->nil)
+                chk = chk->left;
+            lazy_sweep_cursor = chk;
+        }
+
+        /** <summary>Sweep an array if it is pending</summary> */
+        void ensure_swept(sma_header* smhdr)
+        {
+            if (smhdr->sweep_epoch != mark_epoch)
+            {
+                sweep_sma(smhdr, lazy_sweep_minor);
+                smhdr->sweep_epoch = mark_epoch;
+                System.Threading.Interlocked.Add(ref lazy_sweep_pending, -1);
+            }
+        }
+
+        /** <summary>Sweep shared arrays from s onwards until some free space is found</summary> */
+        void sweep_shared_arrays(sma_header* s)
+        {
+            while (s != null && *s->global_free_count == 0)
+            {
+                ensure_swept(s);
+                s = s->next;
+            }
+        }
+
+        /** <summary>Sweep all remaining pending arrays.  Must be called with
+         * collection_in_progress set</summary> */
+        void finish_lazy_sweep()
+        {
+            if (lazy_sweep_pending != 0)
+            {
+                chunk_header* chk = hdr->root_used_chunk;
+                while (chk->left != hdr->nil)
+                    chk = chk->left;
+
+                while (chk != hdr->nil)
+                {
+                    if ((chk->flags & 0x30) == 0x0)
+                        ensure_swept((sma_header*)((byte*)chk + sizeof(chunk_header)));
+                    chk = TreeSuccessor(hdr, 1, chk);
+                }
+            }
+            lazy_sweep_cursor = null;
+        }
+
+        /** <summary>Sweep the next pending shared array.  Returns false once gc_sweep has
+         * looked at every chunk</summary> */
+        bool lazy_sweep_step()
+        {
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            acquire_alloc();
+
+            chunk_header* chk = lazy_sweep_cursor;
+            while (chk != null && chk != hdr->nil)
+            {
+                chunk_header* cur = chk;
+                chk = TreeSuccessor(hdr, 1, chk);
+
+                if ((cur->flags & 0x30) == 0x0)
+                {
+                    sma_header* smhdr = (sma_header*)((byte*)cur + sizeof(chunk_header));
+                    if (smhdr->owner < 0 && smhdr->sweep_epoch != mark_epoch)
+                    {
+                        ensure_swept(smhdr);
+                        break;
+                    }
+                }
+            }
+            if (chk == hdr->nil)
+                chk = null;
+            lazy_sweep_cursor = chk;
+
+            alloc_in_progress = false;
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return chk != null;
+        }
+
+        /** <summary>Free white objects in an array, and whiten and promote black ones</summary> */
+        void sweep_sma(sma_header* smhdr, bool minor)
+        {
+            int white_small = 0, black_small = 0;
+            int global_freed = 0;
+
+            for (int i = 0; i < smhdr->total_count; i += 8)
+            {
+                /* A minor collection need not look at arrays of only old objects */
+                if (minor && smhdr->young_count == 0)
+                    break;
+
+                uint* uint_ptr = (uint*)((byte*)smhdr + sizeof(sma_header) +
+                    i / 2);
+
+                for (int bit_idx = 0; bit_idx < 8; bit_idx++)
+                {
+                    uint flag_pattern = 0x3U << (bit_idx * 4);
+                    uint white_pattern = 0x1U << (bit_idx * 4);
+                    uint black_pattern = 0x2U << (bit_idx * 4);
+                    uint old_pattern = 0x4U << (bit_idx * 4);
+                    bool old = (*uint_ptr & old_pattern) != 0;
+
+                    if (minor && old)
+                        continue;
+
+                    /* debugging - check we are not freeing a process/thread etc */
+                    byte* data_start = (byte*)smhdr + sizeof(sma_header) +
+                        smhdr->total_count * 4;
+                    byte* obj_start = data_start + (i + bit_idx) *
+                        smhdr->obj_length;
+
+                    if ((*uint_ptr & flag_pattern) == white_pattern)
+                    {
+                        /* free the object, clearing its generation and noscan bits too */
+                        *uint_ptr &= ~(0xfU << (bit_idx * 4));
+                        if (!old)
+                            smhdr->young_count--;
+                        smhdr->free_count++;
+                        if (smhdr->owner < 0)
+                            global_freed++;
+                        if (i < smhdr->next_free)
+                            smhdr->next_free = i;
+                        white_small++;
+                    }
+                    else if((*uint_ptr & flag_pattern) == black_pattern)
+                    {
+                        /* whiten and promote the object */
+                        *uint_ptr &= ~flag_pattern;
+                        *uint_ptr |= white_pattern | old_pattern;
+                        if (!old)
+                            smhdr->young_count--;
+                        black_small++;
+                    }
+                    else if((*uint_ptr & flag_pattern) == flag_pattern)
+                    {
+                        Formatter.Write("gengc: WARNING: object at ", Program.arch.DebugOutput);
+                        Formatter.Write((ulong)obj_start, "X", Program.arch.DebugOutput);
+                        Formatter.Write(" is grey on final loop: ", Program.arch.DebugOutput);
+                        Formatter.Write(*uint_ptr & flag_pattern, "X", Program.arch.DebugOutput);
+                        Formatter.WriteLine(Program.arch.DebugOutput);
+                    }
+                }
+            }
+
+            if (global_freed != 0)
+                System.Threading.Interlocked.Add(ref *smhdr->global_free_count, global_freed);
+            if (white_small != 0)
+                System.Threading.Interlocked.Add(ref swept_white_small, white_small);
+            if (black_small != 0)
+                System.Threading.Interlocked.Add(ref swept_black_small, black_small);
+        }
+    }
+}
@@ -0,0 +1,150 @@
+﻿/* Copyright (C) 2026 by John Cronin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Collection triggering for gengc
+ * 
+ * Collections are triggered by the number of bytes allocated since the last one rather
+ * than the number of calls to Alloc, so that a few large buffers count for as much as
+ * many small strings.
+ * 
+ * The size of the heap which survived the last collection is estimated from the objects
+ * shaded whilst marking.  A minor collection only marks young objects, which it promotes,
+ * so their size is added to the estimate.  The next collection is then triggered once
+ * HeapGrowthPercent of the size left by the last full collection has been allocated,
+ * within [min_trigger_bytes, an eighth of the heap].  If more than half of what was
+ * allocated survived, collecting again soon would mostly trace live objects, so the
+ * trigger is doubled.
+ * 
+ * Promoted objects are only freed by a full collection, so the old generation grows with
+ * every minor one.  Once minor collections have promoted more than HeapGrowthPercent of
+ * what the last full collection left (or min_trigger_bytes), the next collection is a
+ * full one, regardless of MinorsPerFull.
+ * 
+ * Separately, an idle-priority thread collects once IdleCollectInterval has passed and
+ * at least idle_min_bytes have been allocated, so that garbage is cleaned up whilst
+ * the system has nothing better to do.
+ */
+
+namespace tysos.gc
+{
+    unsafe partial class gengc
+    {
+        public static int HeapGrowthPercent = 100;
+        public static long IdleCollectInterval = 1000000000;    // ns
+
+        const long min_trigger_bytes = 2 * 1024 * 1024;
+        const long idle_min_bytes = 64 * 1024;
+
+        long allocated_bytes = 0;       // since the last collection
+        long live_bytes = 0;            // estimated size of the heap after the last collection
+        long full_live_bytes = 0;       // size of the heap after the last full collection
+        long promoted_bytes = 0;        // promoted by minor collections since then
+        long trigger_bytes = min_trigger_bytes;
+        int survival_percent = 0;       // of the bytes allocated between the last two collections
+        long last_collection_time = 0;
+
+        void reset_marked_bytes()
+        {
+            for (int i = 0; i < mark_worker_count; i++)
+                get_mark_worker(i)->marked_bytes = 0;
+        }
+
+        long sum_marked_bytes()
+        {
+            long ret = 0;
+            for (int i = 0; i < mark_worker_count; i++)
+                ret += get_mark_worker(i)->marked_bytes;
+            return ret;
+        }
+
+        /** <summary>Choose the allocation volume which triggers the next collection, based
+         * on what survived this one</summary> */
+        void update_trigger(bool minor)
+        {
+            long marked = sum_marked_bytes();
+            long survived;
+            if (minor)
+            {
+                survived = marked;
+                live_bytes += marked;
+                promoted_bytes += marked;
+            }
+            else
+            {
+                survived = marked > live_bytes ? marked - live_bytes : 0;
+                live_bytes = marked;
+                full_live_bytes = marked;
+                promoted_bytes = 0;
+            }
+
+            if (allocated_bytes <= 0)
+                survival_percent = 0;
+            else if (survived >= allocated_bytes)
+                survival_percent = 100;
+            else
+                survival_percent = (int)(survived * 100 / allocated_bytes);
+
+            /* Promotions are not counted here, as many will be garbage by the next full
+             * collection and would otherwise make the young generation grow with them */
+            long trigger = full_live_bytes / 100 * HeapGrowthPercent;
+            if (survival_percent > 50)
+                trigger *= 2;
+
+            long max_trigger = ((byte*)heap_end - (byte*)heap_start) / 8;
+            if (trigger > max_trigger)
+                trigger = max_trigger;
+            if (trigger < min_trigger_bytes)
+                trigger = min_trigger_bytes;
+            trigger_bytes = trigger;
+
+            allocated_bytes = 0;
+            last_collection_time = Program.arch.GetNow();
+        }
+
+        /** <summary>Whether enough has been allocated for a collection to be needed now</summary> */
+        bool collection_due()
+        {
+            return allocated_bytes >= trigger_bytes;
+        }
+
+        /** <summary>Whether minor collections have promoted enough that the next collection
+         * should be a full one</summary> */
+        bool old_generation_full()
+        {
+            long limit = full_live_bytes / 100 * HeapGrowthPercent;
+            if (limit < min_trigger_bytes)
+                limit = min_trigger_bytes;
+            return promoted_bytes >= limit;
+        }
+
+        /** <summary>Whether it is worth collecting now that the system is idle</summary> */
+        bool idle_collection_due()
+        {
+            if (allocated_bytes < idle_min_bytes)
+                return false;
+
+            /* Without a timer, collect whenever idle */
+            long now = Program.arch.GetNow();
+            return now == 0 || now - last_collection_time >= IdleCollectInterval / 100;
+        }
+    }
+}
@@ -42,9 +42,27 @@ namespace tysos.gc
         internal enum HeapType { Startup, BoehmGC, TysosGC, PerCPU, GenGC };
         internal static HeapType Heap;
 
+        /** <summary>Write every allocation and reference store to the debug output, see
+         * alloc_trace.cs</summary> */
+        internal static bool TraceAllocations = false;
+
         [AlwaysCompile]
         [MethodAlias("gcmalloc")]
         internal static ulong Alloc(ulong size)
+        {
+            return Alloc(size, false);
+        }
+
+        /** <summary>Allocate an object which contains no references, e.g. an array of a
+         * primitive type or a string.  The collector does not scan it.</summary> */
+        [AlwaysCompile]
+        [MethodAlias("gcmalloc_noscan")]
+        internal static ulong AllocNoScan(ulong size)
+        {
+            return Alloc(size, true);
+        }
+
+        static ulong Alloc(ulong size, bool noscan)
         {
             ulong ret = 0;
             switch (Heap)
@@ -60,7 +78,7 @@ namespace tysos.gc
                 case HeapType.GenGC:
                     unsafe
                     {
-                        ret = (ulong)gengc.heap.Alloc((int)size);
+                        ret = (ulong)gengc.heap.Alloc((int)size, noscan);
                     }
                     break;
 
@@ -76,9 +94,30 @@ namespace tysos.gc
                 libsupcs.MemoryOperations.MemSet((void*)ret, 0, (int)size);
             }
 
+            if (TraceAllocations)
+                alloc_trace.Alloc(ret, size, noscan);
+
             return ret;
         }
 
+        /** <summary>Must be called after a reference is stored to slot, if the heap is to
+         * run minor collections</summary> */
+        [AlwaysCompile]
+        [MethodAlias("gcwritebarrier")]
+        internal static void WriteBarrier(ulong slot)
+        {
+            if (Heap == HeapType.GenGC)
+            {
+                unsafe
+                {
+                    gengc.heap.WriteBarrier((void*)slot);
+                }
+            }
+
+            if (TraceAllocations)
+                alloc_trace.Store(slot);
+        }
+
         internal static void ScheduleCollection()
         {
 
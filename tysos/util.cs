@@ -47,6 +47,21 @@ namespace tysos
             return input - i_rem_f + factor;
         }
 
+        /** <summary>Returns the index of the most significant set bit, or -1 if none are set</summary> */
+        public static int HighestSetBit(uint v)
+        {
+            if (v == 0)
+                return -1;
+
+            int ret = 0;
+            if ((v & 0xffff0000U) != 0) { v >>= 16; ret += 16; }
+            if ((v & 0xff00U) != 0) { v >>= 8; ret += 8; }
+            if ((v & 0xf0U) != 0) { v >>= 4; ret += 4; }
+            if ((v & 0xcU) != 0) { v >>= 2; ret += 2; }
+            if ((v & 0x2U) != 0) { ret += 1; }
+            return ret;
+        }
+
         /** <summary>Adds a long to a ulong (or subtracts if the value is negative)</summary> */
         public static ulong Add(ulong a, long b)
         {
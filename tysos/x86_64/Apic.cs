@@ -143,6 +143,12 @@ namespace tysos.x86_64
 
         long ticks = 0;
 
+        /* One-shot mode state */
+        bool one_shot = false;
+        ulong counts_per_ms = 0;        // timer counts per ms at the current divisor
+        long armed_ns = 0;              // length of the current one-shot period, or 0 if stopped
+        long unreported_ns = 0;         // time elapsed in periods cut short by re-arming
+
         internal override long TimerInterval { get { return _interval; } }
 
         public ulong LApicTimerDivisor
@@ -363,6 +369,83 @@ namespace tysos.x86_64
             Formatter.WriteLine(" ns", Program.arch.DebugOutput);
         }
 
+        internal override bool SupportsOneShot { get { return calibrated; } }
+
+        internal override void SetOneShot(long ns)
+        {
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+            if (counts_per_ms == 0)
+                counts_per_ms = (ulong)(lapic_base_freq / 1000.0 / Convert.ToDouble((long)LApicTimerDivisor));
+
+            /* Account for any time elapsed in the period we are cutting short */
+            long elapsed = _OneShotElapsed();
+            ticks += elapsed;
+            unreported_ns += elapsed;
+
+            if (!one_shot)
+            {
+                /* Clear the periodic mode and mask bits, keeping the vector */
+                uint lapic_reg = ReadConfDword(LVT_timer_offset);
+                lapic_reg &= 0xfffcffff;
+                WriteConfDword(LVT_timer_offset, lapic_reg);
+                one_shot = true;
+            }
+
+            if (ns < 0)
+            {
+                /* A zero initial count stops the timer */
+                WriteConfDword(Initial_Count_offset, 0);
+                armed_ns = 0;
+            }
+            else
+            {
+                ulong max_ns = (ulong)uint.MaxValue / counts_per_ms * 1000000UL;
+                if ((ulong)ns > max_ns)
+                    ns = (long)max_ns;
+
+                ulong count = (ulong)ns * counts_per_ms / 1000000UL;
+                if (count == 0)
+                    count = 1;
+
+                armed_ns = ns;
+                WriteConfDword(Initial_Count_offset, (uint)count);
+            }
+
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+        }
+
+        internal override long OneShotRemaining
+        {
+            get
+            {
+                if (!one_shot || armed_ns == 0)
+                    return -1;
+                return (long)((ulong)ReadConfDword(Current_Count_offset) * 1000000UL / counts_per_ms);
+            }
+        }
+
+        /** <summary>Time (in ns) elapsed in the current one-shot period</summary> */
+        long _OneShotElapsed()
+        {
+            long remaining = OneShotRemaining;
+            if (remaining < 0)
+                return 0;
+            if (remaining > armed_ns)
+                return 0;
+            return armed_ns - remaining;
+        }
+
+        /** <summary>Send a fixed interrupt to the local APIC with the given id</summary> */
+        public void SendIPI(uint dest_apic_id, byte vector)
+        {
+            /* Wait for any previous IPI to be accepted before reusing the ICR */
+            while ((ReadConfDword(ICR_dw0) & 0x1000U) != 0) ;
+
+            WriteConfDword(ICR_dw1, dest_apic_id << 24);
+            WriteConfDword(ICR_dw0, 0x00004000U | vector);     // fixed delivery, physical destination, assert
+        }
+
         public void SetSpuriousVector(byte target_vector)
         {
             uint siv = ReadConfDword(Spurious_Interrupt_Vector_reg_offset);
@@ -483,12 +566,28 @@ namespace tysos.x86_64
         {
             LApic cur_lapic = ((x86_64.x86_64_cpu)Program.arch.CurrentCpu).CurrentLApic;
 
-            cur_lapic.ticks += cur_lapic._interval;
+            long interval = cur_lapic._interval;
+            if (cur_lapic.one_shot)
+            {
+                /* Report the time elapsed in the current period, plus any time from periods
+                 * which were re-armed before they expired.  If the timer is still counting
+                 * then this interrupt was raised by a period which has since been re-armed,
+                 * so restart the accounting from here */
+                long elapsed = cur_lapic._OneShotElapsed();
+                long remaining = cur_lapic.OneShotRemaining;
+                interval = elapsed + cur_lapic.unreported_ns;
+                cur_lapic.ticks += elapsed;
+                cur_lapic.armed_ns = (remaining > 0) ? remaining : 0;
+                cur_lapic.unreported_ns = 0;
+            }
+            else
+                cur_lapic.ticks += interval;
+
             cur_lapic.SendEOI();
             if (cur_lapic.callback != null)
-                cur_lapic.callback(cur_lapic._interval);
+                cur_lapic.callback(interval);
         }
 
-        internal override long Ticks { get { return ticks / 100; } }
+        internal override long Ticks { get { return (ticks + _OneShotElapsed()) / 100; } }
     }
 }
@@ -583,17 +583,21 @@ namespace tysos.x86_64
                 Interrupts.InstallHandler(0x60, new Interrupts.ISR(tysos.x86_64.LApic.SpuriousApicInterrupt));
             }
 
-            bsp_lapic.SetTimer(true, 100.0, 0x40);      // 10 ms timer
+            bsp_lapic.SetTimer(true, 100.0, x86_64_cpu.TimerVector);      // 10 ms timer
             //bsp_lapic.SetTimer(true, 0x144b50, 0x40);   // 10ms timer with 133 Mhz bus and divisor 1, interrupt vector 0x40
             unsafe
             {
-                Interrupts.InstallHandler(0x40, new Interrupts.ISR(tysos.x86_64.LApic.TimerInterrupt));
+                Interrupts.InstallHandler(x86_64_cpu.TimerVector, new Interrupts.ISR(tysos.x86_64.LApic.TimerInterrupt));
             }
             SchedulerTimer = bsp_lapic;
 
             /* Set up the current cpu */
             bsp.CurrentLApic = bsp_lapic;
+            bsp.CurrentTimer = bsp_lapic;
 
+            /* Only the bootstrap processor is started.  Before any application processors
+             * are added here, Vmem needs a TLB shootdown IPI: until then it refuses to unmap
+             * pages once more than one cpu is listed. */
             Processors = new List<Cpu>();
             Processors.Add(Program.arch.CurrentCpu);
 
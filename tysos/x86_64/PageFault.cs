@@ -253,12 +253,17 @@ namespace tysos.x86_64
         static void do_map(ulong vaddr, ulong ec)
         {
             /* If the error was a read, we only need to map a pre-existing blank
-             * page (to save on physical memory space), otherwise map a new page */
+             * page copy-on-write (to save on physical memory space).  A write to a
+             * copy-on-write page gets its own copy, otherwise map a new page */
 
             if((ec & 0x2) == 0)
             {
                 // was read - use the blank page
-                Program.arch.VirtMem.Map(Program.arch.PhysMem.BlankPage, 0x1000, vaddr & ~0xfffUL, 0);
+                Program.arch.VirtMem.Map(Program.arch.PhysMem.BlankPage, 0x1000, vaddr & ~0xfffUL, VirtMem.FLAG_cow);
+            }
+            else if((ec & 0x1) != 0 && Program.arch.VirtMem.CopyOnWrite(vaddr & ~0xfffUL))
+            {
+                // was write to a present copy-on-write page, which now has its own copy
             }
             else
             {
@@ -1,17 +1,23 @@
 ﻿using System;
 using System.Collections.Generic;
 using System.Text;
+using System.Runtime.CompilerServices;
 
 namespace tysos.x86_64
 {
-    class Pmem : PhysMem
+    unsafe class Pmem : PhysMem
     {
         PhysMem.PmemBitmap dma;
         PhysMem.PmemRegion upper;
 
         public override ulong GetPage()
         {
-            var ret = Allocate(0x1000);
+            // Pages zeroed in the background are ready to use
+            var ret = zero_pool_get_page();
+            if (ret != 0)
+                return ret;
+
+            ret = Allocate(0x1000);
 
             /*Formatter.Write("x86_64.Pmem.GetPage() returning ", Program.arch.DebugOutput);
             Formatter.Write(ret, "X", Program.arch.DebugOutput);
@@ -37,7 +43,33 @@ namespace tysos.x86_64
             return ret;
         }
 
+        /* Clears the pool's pages with non-temporal stores, so that background zeroing
+         *  does not evict anything useful from the cache */
+        protected override void ClearPage(ulong paddr)
+        {
+            zero_page_nt(Vmem.direct_start + paddr);
+        }
+
+        [MethodImpl(MethodImplOptions.InternalCall)]
+        extern static void zero_page_nt(ulong vaddr);
+
         public override ulong Allocate(ulong len)
+        {
+            // Single pages come from the per-cpu magazines where possible
+            if (len <= 0x1000)
+            {
+                var r = magazine_get_page();
+                if (r != 0)
+                    return r;
+            }
+
+            var ret = global_allocate(len);
+            if (ret == 0 && magazine_flush())
+                ret = global_allocate(len);
+            return ret;
+        }
+
+        ulong global_allocate(ulong len)
         {
             var x = upper;
             while(x != null)
@@ -57,7 +89,7 @@ namespace tysos.x86_64
         {
             get
             {
-                ulong v = 0;
+                ulong v = magazine_free_space() + zero_pool_free_space();
                 if (dma != null)
                     v += dma.FreeSpace;
                 var x = upper;
@@ -72,17 +104,102 @@ namespace tysos.x86_64
 
         public override ulong AllocateFixed(ulong paddr, ulong len)
         {
-            throw new NotImplementedException();
+            var x = upper;
+            while(x != null)
+            {
+                if (paddr >= x.StartAddr && (paddr + len) <= x.EndAddr)
+                {
+                    var ret = x.AllocateFixed(paddr, len);
+                    if (ret == 0 && magazine_flush())
+                        ret = x.AllocateFixed(paddr, len);
+                    return ret;
+                }
+                x = x.next;
+            }
+            return 0;
+        }
+
+        protected override int* get_refcount(ulong paddr)
+        {
+            var x = upper;
+            while(x != null)
+            {
+                if (paddr >= x.StartAddr && paddr < x.EndAddr)
+                    return x.RefCount(paddr);
+                x = x.next;
+            }
+            return null;
+        }
+
+        protected override int AllocatePages(ulong* pages, int count)
+        {
+            // Visit each region once for the whole batch
+            int n = 0;
+            var x = upper;
+            while(x != null && n < count)
+            {
+                n += x.AllocatePages(pages + n, count - n);
+                x = x.next;
+            }
+            if (n < count && dma != null)
+                n += dma.AllocatePages(pages + n, count - n);
+            return n;
+        }
+
+        protected override void ReleasePages(ulong* pages, int count)
+        {
+            /* Gather the pages belonging to each region at the front of what is left, so
+             * that each region is given its share in one go */
+            int i = 0;
+            while(i < count)
+            {
+                PhysMem.PmemRegion x = upper;
+                while (x != null && (pages[i] < x.StartAddr || pages[i] >= x.EndAddr))
+                    x = x.next;
+                if (x == null && in_dma(pages[i]))
+                    x = dma;
+                if (x == null)
+                {
+                    global_release(pages[i++], 0x1000);
+                    continue;
+                }
+
+                int n = 1;
+                for (int j = i + 1; j < count; j++)
+                {
+                    if (pages[j] >= x.StartAddr && pages[j] < x.EndAddr)
+                    {
+                        var t = pages[i + n];
+                        pages[i + n] = pages[j];
+                        pages[j] = t;
+                        n++;
+                    }
+                }
+                x.ReleasePages(pages + i, n);
+                i += n;
+            }
         }
 
         public override void Release(ulong paddr, ulong len)
+        {
+            if (len <= 0x1000 && magazine_put_page(paddr))
+                return;
+            global_release(paddr, len);
+        }
+
+        bool in_dma(ulong paddr)
+        {
+            return dma != null && paddr >= dma.StartAddr && paddr < dma.EndAddr;
+        }
+
+        void global_release(ulong paddr, ulong len)
         {
             // Is the new region entirely within a block? In which case add to it.
             var x = upper;
 
             while(x != null)
             {
-                if (paddr >= x.StartAddr && (paddr + len) < x.EndAddr)
+                if (paddr >= x.StartAddr && (paddr + len) <= x.EndAddr)
                 {
                     x.Release(paddr, len);
                     return;
@@ -91,8 +208,24 @@ namespace tysos.x86_64
                 x = x.next;
             }
 
-            // Else create a new block
-            var nb = new PhysMem.PmemTwoLevelStack(this, paddr, len);
+            if (in_dma(paddr) && paddr + len <= dma.EndAddr)
+            {
+                dma.Release(paddr, len);
+                return;
+            }
+
+            /* Else create a new block.  Its metadata goes at its start, so a range too small
+             *  to hold that and a page as well cannot be tracked and is not used */
+            if (!PhysMem.PmemBuddy.CanHold(paddr, len))
+            {
+                Formatter.Write("x86_64.Pmem: ignoring release of untracked range ", Program.arch.DebugOutput);
+                Formatter.Write(paddr, "X", Program.arch.DebugOutput);
+                Formatter.Write(" length ", Program.arch.DebugOutput);
+                Formatter.Write(len, "X", Program.arch.DebugOutput);
+                Formatter.WriteLine(Program.arch.DebugOutput);
+                return;
+            }
+            var nb = new PhysMem.PmemBuddy(this, paddr, len);
 
             // Add to start of list?
             if (upper == null)
@@ -33,6 +33,18 @@ namespace tysos.x86_64
         const ulong paddr_mask = 0xffffffffff000;
         const ulong page_mask = 0xfffffffffffff000;
         const ulong canonical_only = 0xffffffffffff;
+        const ulong page_size_bit = 0x80;
+        const ulong cow_bit = 0x200;        // available to software, marks copy-on-write
+        const ulong pat_large_bit = 0x1000; // PAT bit of a 2 MiB or 1 GiB page
+        const ulong pat_4k_bit = 0x80;      // PAT bit of a 4 KiB page
+
+        /* Attributes carried over when a large page is split: present, writeable, user,
+         * write-through, cache disable, global and no-execute */
+        const ulong split_attrs = 0x1fUL | 0x100UL | (1UL << 63);
+
+        /* 2 MiB pages are always available in long mode.  1 GiB pages need checking for */
+        bool has_2m_pages = true;
+        bool has_1g_pages = false;
 
         const ulong psize = 0x1000;
 
@@ -47,8 +59,6 @@ namespace tysos.x86_64
                 return new VMapping { flags = 0, paddr = paddr, len = len, vaddr = paddr + direct_start };
             }
 
-            // Map as 4k chunks for now
-
             /*Formatter.Write("x86_64.Vmem.Map, paddr=", Program.arch.DebugOutput);
             Formatter.Write(paddr, "X", Program.arch.DebugOutput);       
             Formatter.Write(", vaddr=", Program.arch.DebugOutput);
@@ -77,9 +87,40 @@ namespace tysos.x86_64
 
             while(cur_len != 0UL)
             {
+                /* Use large pages where both addresses are suitably aligned, unless finer
+                 * mappings already exist there.  Pages allocated or shared here are only
+                 * 4 KiB. */
+                if ((flags & (FLAG_allocate | FLAG_cow)) == 0)
+                {
+                    if (has_1g_pages && cur_len >= ps1g && ((cur_vaddr | cur_paddr) & pm1g) == 0 &&
+                        Map1G(cur_vaddr, cur_paddr, pmem, flags))
+                    {
+                        cur_len -= ps1g;
+                        cur_paddr += ps1g;
+                        cur_vaddr += ps1g;
+                        continue;
+                    }
+                    if (has_2m_pages && cur_len >= ps2m && ((cur_vaddr | cur_paddr) & pm2m) == 0 &&
+                        Map2M(cur_vaddr, cur_paddr, pmem, flags))
+                    {
+                        cur_len -= ps2m;
+                        cur_paddr += ps2m;
+                        cur_vaddr += ps2m;
+                        continue;
+                    }
+                }
+
                 if ((flags & FLAG_allocate) != 0)
                     cur_paddr = pmem.GetPage();
-                Map4k(cur_vaddr, cur_paddr, pmem, flags);
+                if ((flags & FLAG_cow) != 0 && !Program.arch.PhysMem.SharePage(cur_paddr))
+                {
+                    // Cannot be shared, so the copy has to be made now
+                    var copy = pmem.GetPage();
+                    libsupcs.MemoryOperations.MemCpy((void*)(direct_start + copy), (void*)(direct_start + cur_paddr), 0x1000);
+                    Map4k(cur_vaddr, copy, pmem, (flags & ~FLAG_cow) | FLAG_writeable);
+                }
+                else
+                    Map4k(cur_vaddr, cur_paddr, pmem, flags);
 
                 cur_len -= 0x1000UL;
                 cur_paddr += 0x1000UL;
@@ -89,6 +130,135 @@ namespace tysos.x86_64
             return new VMapping { flags = flags, paddr = paddr, len = len, vaddr = vaddr };
         }
 
+        public override ulong Unmap(ulong vaddr)
+        {
+            /* Pages within a large page are unmapped individually, so it is split first */
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            ulong pt_entry_addr = get_pte_addr(vaddr);
+            if (pt_entry_addr == 0)
+            {
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                return 0;
+            }
+
+            ulong pte = pstructs[pt_entry_addr];
+            pstructs[pt_entry_addr] = 0;
+            flush_tlb(vaddr);
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+
+            return pte & paddr_mask;
+        }
+
+        /** <summary>Find the page table entry for a present 4 KiB page, splitting any large
+         * page which covers it.  Returns 0 if vaddr is not mapped.  Must be called with
+         * interrupts disabled</summary> */
+        ulong get_pte_addr(ulong vaddr)
+        {
+            ulong page_index = vaddr & canonical_only;
+
+            ulong pml4t_entry_addr = get_pml4t_entry_addr(page_index);
+            ulong pdpt_entry_addr = get_pdpt_entry_addr(page_index);
+            ulong pd_entry_addr = get_pd_entry_addr(page_index);
+            ulong pt_entry_addr = get_pt_entry_addr(page_index);
+
+            if (!is_enabled(pstructs[pml4t_entry_addr]) ||
+                !is_enabled(pstructs[pdpt_entry_addr]))
+                return 0;
+            if (is_large(pstructs[pdpt_entry_addr]))
+                split_1g(vaddr, pdpt_entry_addr, pd_entry_addr, pmem);
+            if (!is_enabled(pstructs[pd_entry_addr]))
+                return 0;
+            if (is_large(pstructs[pd_entry_addr]))
+                split_2m(vaddr, pd_entry_addr, pt_entry_addr, pmem);
+            if (!is_enabled(pstructs[pt_entry_addr]))
+                return 0;
+            return pt_entry_addr;
+        }
+
+        public override bool CopyOnWrite(ulong vaddr)
+        {
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+            ulong pt_entry_addr = get_pte_addr(vaddr);
+            if (pt_entry_addr == 0 || (pstructs[pt_entry_addr] & cow_bit) == 0)
+            {
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                return false;
+            }
+
+            var pm = Program.arch.PhysMem;
+            ulong pte = pstructs[pt_entry_addr];
+            ulong paddr = pte & paddr_mask;
+            ulong attrs = (pte & ~paddr_mask & ~cow_bit) | 0x2;
+
+            if (!pm.IsShared(paddr))
+            {
+                // The other mappings have gone, so take the page over
+                pstructs[pt_entry_addr] = attrs | paddr;
+            }
+            else
+            {
+                var copy = pm.GetPage();
+                if (paddr != pm.BlankPage)
+                    libsupcs.MemoryOperations.MemCpy((void*)(direct_start + copy), (void*)(direct_start + paddr), 0x1000);
+                pstructs[pt_entry_addr] = attrs | copy;
+
+                // The other mappings may have gone away whilst we copied
+                pm.ReleaseMapped(paddr);
+            }
+            flush_tlb(vaddr);
+
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return true;
+        }
+
+        public override void ShareCopyOnWrite(ulong src_vaddr, ulong dest_vaddr, ulong len)
+        {
+            var pm = Program.arch.PhysMem;
+            src_vaddr &= page_mask;
+            dest_vaddr &= page_mask;
+
+            for (ulong offset = 0; offset < len; offset += 0x1000)
+            {
+                var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+
+                ulong pt_entry_addr = get_pte_addr(src_vaddr + offset);
+                if (pt_entry_addr != 0)
+                {
+                    ulong pte = pstructs[pt_entry_addr];
+                    ulong paddr = pte & paddr_mask;
+
+                    if (pm.SharePage(paddr))
+                    {
+                        // Both sides now copy on write
+                        pstructs[pt_entry_addr] = (pte & ~0x2UL) | cow_bit;
+                        flush_tlb(src_vaddr + offset);
+                        Map4k(dest_vaddr + offset, paddr, pmem, FLAG_cow);
+                    }
+                    else
+                    {
+                        var copy = pmem.GetPage();
+                        libsupcs.MemoryOperations.MemCpy((void*)(direct_start + copy), (void*)(direct_start + paddr), 0x1000);
+                        Map4k(dest_vaddr + offset, copy, pmem, FLAG_writeable);
+                    }
+                }
+
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            }
+        }
+
+        /** <summary>Invalidate the TLB entry for a page which has been unmapped, remapped or
+         * made read-only.  Only the current cpu is flushed, as there is no shootdown IPI yet.
+         * This is correct whilst the bootstrap processor is the only one started (see
+         * Arch.Init), and the check below catches any attempt to rely on it otherwise</summary> */
+        void flush_tlb(ulong vaddr)
+        {
+            var cpus = Program.arch.Processors;
+            if (cpus != null && cpus.Count > 1)
+                throw new Exception("Vmem: TLB shootdown is not supported with more than one cpu running");
+            libsupcs.x86_64.Cpu.Invlpg(vaddr & page_mask);
+        }
+
         public override ulong PageSize => psize;
 
         public Vmem()
@@ -100,9 +270,15 @@ namespace tysos.x86_64
          * physical memory at 0xffffff0000000000</summary> */
         public unsafe void GenerateDirectMapping(List<EarlyPageProvider.EPPRegion> free_blocks, PageProvider pp)
         {
-            // TODO: get from CPUID
-            bool arch_has_2m_pages = false;
-            bool arch_has_1g_pages = false;
+            /* 1 GiB pages are CPUID.80000001h:EDX bit 26 */
+            uint[] cpuid_ext = libsupcs.x86_64.Cpu.Cpuid(0x80000000U);
+            if (cpuid_ext[0] >= 0x80000001U)
+            {
+                uint[] cpuid_ext1 = libsupcs.x86_64.Cpu.Cpuid(0x80000001U);
+                has_1g_pages = (cpuid_ext1[3] & (1U << 26)) != 0;
+            }
+            bool arch_has_2m_pages = has_2m_pages;
+            bool arch_has_1g_pages = has_1g_pages;
 
             // Current virtual addresses of page table entries
             //ulong* cpml4, cpdpt, cpd, cpt;
@@ -117,14 +293,14 @@ namespace tysos.x86_64
                 while (x + 0x1000 <= fb.start + fb.length)
                 {
                     // Can we do a large mapping?
-                    if (arch_has_1g_pages && ((x & pm1g) == 0) && (x + ps1g <= fb.start + fb.length))
+                    if (arch_has_1g_pages && ((x & pm1g) == 0) && (x + ps1g <= fb.start + fb.length) &&
+                        Map1G(direct_start + x, x, pp, FLAG_writeable))
                     {
-                        Map1G(direct_start + x, x, pp, FLAG_writeable);
                         x += ps1g;
                     }
-                    else if(arch_has_2m_pages && ((x * pm2m) == 0) && (x + ps2m <= fb.start + fb.length))
+                    else if(arch_has_2m_pages && ((x & pm2m) == 0) && (x + ps2m <= fb.start + fb.length) &&
+                        Map2M(direct_start + x, x, pp, FLAG_writeable))
                     {
-                        Map2M(direct_start + x, x, pp, FLAG_writeable);
                         x += ps2m;
                     }
                     else
@@ -150,6 +326,85 @@ namespace tysos.x86_64
                 return true;
             return false;
         }
+        bool is_large(ulong pte)
+        {
+            return (pte & (page_size_bit | 0x1)) == (page_size_bit | 0x1);
+        }
+
+        static ulong get_page_attrs(uint flags)
+        {
+            ulong page_attrs = 0x1; // Present bit
+            if ((flags & FLAG_cow) != 0)
+                page_attrs |= cow_bit;
+            else if ((flags & FLAG_writeable) != 0)
+                page_attrs |= 0x2;
+            if ((flags & FLAG_write_through) != 0)
+                page_attrs |= 0x8;
+            if ((flags & FLAG_cache_disable) != 0)
+                page_attrs |= 0x10;
+            return page_attrs;
+        }
+
+        /** <summary>Create the table which entry_addr points to, if it is not present.  Its
+         * entries start at child_entry_addr</summary> */
+        void ensure_table(ulong entry_addr, ulong child_entry_addr, PageProvider pp)
+        {
+            if ((pstructs[entry_addr] & 0x1) == 0)
+            {
+                ulong p_page = pp.GetPage();
+                pstructs[entry_addr] = 0x3 | (p_page & paddr_mask);
+                libsupcs.x86_64.Cpu.Invlpg((child_entry_addr * 8 + pstruct_start) & page_mask);
+                libsupcs.MemoryOperations.QuickClearAligned16((child_entry_addr * 8 + pstruct_start) & page_mask, 0x1000);
+            }
+        }
+
+        /** <summary>Replace the 1 GiB page covering vaddr with a page directory of 2 MiB pages
+         * covering the same memory with the same attributes, so that part of it can be
+         * remapped.  Must be called with interrupts disabled</summary> */
+        void split_1g(ulong vaddr, ulong pdpt_entry_addr, ulong pd_entry_addr, PageProvider pp)
+        {
+            /* Allocating the table may touch memory within the page being split, so it is
+             * done, and the table filled in through the direct mapping, whilst the large page
+             * is still mapped */
+            ulong table = pp.GetPage() & paddr_mask;
+            ulong old = pstructs[pdpt_entry_addr];
+            ulong paddr = old & paddr_mask & ~pm1g;
+            ulong attrs = old & (split_attrs | pat_large_bit);
+
+            ulong* pd = (ulong*)(direct_start + table);
+            for (ulong i = 0; i < 512; i++)
+                pd[i] = attrs | page_size_bit | (paddr + i * ps2m);
+
+            replace_large(vaddr, pdpt_entry_addr, pd_entry_addr, old, table);
+        }
+
+        /** <summary>Replace the 2 MiB page covering vaddr with a page table, as split_1g</summary> */
+        void split_2m(ulong vaddr, ulong pd_entry_addr, ulong pt_entry_addr, PageProvider pp)
+        {
+            ulong table = pp.GetPage() & paddr_mask;
+            ulong old = pstructs[pd_entry_addr];
+            ulong paddr = old & paddr_mask & ~pm2m;
+            ulong attrs = old & split_attrs;
+            if ((old & pat_large_bit) != 0)
+                attrs |= pat_4k_bit;
+
+            ulong* pt = (ulong*)(direct_start + table);
+            for (ulong i = 0; i < 512; i++)
+                pt[i] = attrs | (paddr + i * ps4k);
+
+            replace_large(vaddr, pd_entry_addr, pt_entry_addr, old, table);
+        }
+
+        /** <summary>Point the entry which held a large page at the table which now describes
+         * it, in a single store.  The translations are unchanged, but the old large page and
+         * the recursive mapping of the entry's child table are flushed so neither is used
+         * again</summary> */
+        void replace_large(ulong vaddr, ulong entry_addr, ulong child_entry_addr, ulong old, ulong table)
+        {
+            pstructs[entry_addr] = 0x3UL | (old & 0x4UL) | table;
+            libsupcs.x86_64.Cpu.Invlpg(vaddr & page_mask);
+            libsupcs.x86_64.Cpu.Invlpg((child_entry_addr * 8 + pstruct_start) & page_mask);
+        }
 
         private void Map4k(ulong vaddr, ulong paddr, PageProvider pp, uint flags = 0)
         {            
@@ -165,57 +420,77 @@ namespace tysos.x86_64
             ulong pd_entry_addr = get_pd_entry_addr(page_index);
             ulong pt_entry_addr = get_pt_entry_addr(page_index);
 
-            // Create pages in the paging hierarchy as necessary
-            if ((pstructs[pml4t_entry_addr] & 0x1) == 0)
-            {
-                ulong p_page = pp.GetPage();
-                pstructs[pml4t_entry_addr] = 0x3 | (p_page & paddr_mask);
-                libsupcs.x86_64.Cpu.Invlpg((pdpt_entry_addr * 8 + pstruct_start) & page_mask);
-                libsupcs.MemoryOperations.QuickClearAligned16((pdpt_entry_addr * 8 + pstruct_start) & page_mask, 0x1000);
-            }
-            if ((pstructs[pdpt_entry_addr] & 0x1) == 0)
-            {
-                ulong p_page = pp.GetPage();
-                pstructs[pdpt_entry_addr] = 0x3 | (p_page & paddr_mask);
-                libsupcs.x86_64.Cpu.Invlpg((pd_entry_addr * 8 + pstruct_start) & page_mask);
-                libsupcs.MemoryOperations.QuickClearAligned16((pd_entry_addr * 8 + pstruct_start) & page_mask, 0x1000);
-            }
-            if ((pstructs[pdpt_entry_addr] & 0x1) == 0)
-            {
-                ulong p_page = pp.GetPage();
-                pstructs[pdpt_entry_addr] = 0x3 | (p_page & paddr_mask);
-                libsupcs.x86_64.Cpu.Invlpg((pd_entry_addr * 8 + pstruct_start) & page_mask);
-                libsupcs.MemoryOperations.QuickClearAligned16((pd_entry_addr * 8 + pstruct_start) & page_mask, 0x1000);
-            }
-            if ((pstructs[pd_entry_addr] & 0x1) == 0)
-            {
-                ulong p_page = pp.GetPage();
-                pstructs[pd_entry_addr] = 0x3 | (p_page & paddr_mask);
-                libsupcs.x86_64.Cpu.Invlpg((pt_entry_addr * 8 + pstruct_start) & page_mask);
-                libsupcs.MemoryOperations.QuickClearAligned16((pt_entry_addr * 8 + pstruct_start) & page_mask, 0x1000);
-            }
+            // Create pages in the paging hierarchy as necessary, splitting any large page
+            // which covers vaddr
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            ensure_table(pml4t_entry_addr, pdpt_entry_addr, pp);
+            if (is_large(pstructs[pdpt_entry_addr]))
+                split_1g(vaddr, pdpt_entry_addr, pd_entry_addr, pp);
+            ensure_table(pdpt_entry_addr, pd_entry_addr, pp);
+            if (is_large(pstructs[pd_entry_addr]))
+                split_2m(vaddr, pd_entry_addr, pt_entry_addr, pp);
+            ensure_table(pd_entry_addr, pt_entry_addr, pp);
 
             /* Set the attributes of the page */
-            ulong page_attrs = 0x1; // Present bit
-            if ((flags & FLAG_writeable) != 0)
-                page_attrs |= 0x2;
-            if ((flags & FLAG_write_through) != 0)
-                page_attrs |= 0x8;
-            if ((flags & FLAG_cache_disable) != 0)
-                page_attrs |= 0x10;
-
-            pstructs[pt_entry_addr] = page_attrs | (paddr & paddr_mask);
+            pstructs[pt_entry_addr] = get_page_attrs(flags) | (paddr & paddr_mask);
             libsupcs.x86_64.Cpu.Invlpg(vaddr & page_mask);
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
         }
 
-        private void Map2M(ulong v, ulong x, PageProvider pp, uint flags = 0)
+        /** <summary>Map a 2 MiB page.  Returns false if vaddr is already covered by a page
+         * table, in which case the caller should use 4 KiB pages</summary> */
+        private bool Map2M(ulong vaddr, ulong paddr, PageProvider pp, uint flags = 0)
         {
-            throw new NotImplementedException();
+            ulong page_index = vaddr & canonical_only;
+
+            ulong pml4t_entry_addr = get_pml4t_entry_addr(page_index);
+            ulong pdpt_entry_addr = get_pdpt_entry_addr(page_index);
+            ulong pd_entry_addr = get_pd_entry_addr(page_index);
+            ulong pt_entry_addr = get_pt_entry_addr(page_index);
+
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            ensure_table(pml4t_entry_addr, pdpt_entry_addr, pp);
+            if (is_large(pstructs[pdpt_entry_addr]))
+                split_1g(vaddr, pdpt_entry_addr, pd_entry_addr, pp);
+            ensure_table(pdpt_entry_addr, pd_entry_addr, pp);
+
+            ulong pde = pstructs[pd_entry_addr];
+            if (is_enabled(pde) && !is_large(pde))
+            {
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                return false;
+            }
+
+            pstructs[pd_entry_addr] = get_page_attrs(flags) | page_size_bit | (paddr & paddr_mask & ~pm2m);
+            libsupcs.x86_64.Cpu.Invlpg(vaddr & page_mask);
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return true;
         }
 
-        private void Map1G(ulong v, ulong x, PageProvider pp, uint flags = 0)
+        /** <summary>Map a 1 GiB page.  Returns false if vaddr is already covered by a page
+         * directory, in which case the caller should use smaller pages</summary> */
+        private bool Map1G(ulong vaddr, ulong paddr, PageProvider pp, uint flags = 0)
         {
-            throw new NotImplementedException();
+            ulong page_index = vaddr & canonical_only;
+
+            ulong pml4t_entry_addr = get_pml4t_entry_addr(page_index);
+            ulong pdpt_entry_addr = get_pdpt_entry_addr(page_index);
+            ulong pd_entry_addr = get_pd_entry_addr(page_index);
+
+            var state = libsupcs.OtherOperations.EnterUninterruptibleSection();
+            ensure_table(pml4t_entry_addr, pdpt_entry_addr, pp);
+
+            ulong pdpte = pstructs[pdpt_entry_addr];
+            if (is_enabled(pdpte) && !is_large(pdpte))
+            {
+                libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+                return false;
+            }
+
+            pstructs[pdpt_entry_addr] = get_page_attrs(flags) | page_size_bit | (paddr & paddr_mask & ~pm1g);
+            libsupcs.x86_64.Cpu.Invlpg(vaddr & page_mask);
+            libsupcs.OtherOperations.ExitUninterruptibleSection(state);
+            return true;
         }
 
         public override bool IsValid(ulong vaddr)
@@ -233,8 +508,12 @@ namespace tysos.x86_64
                 return false;
             if (!is_enabled(pstructs[pdpt_entry_addr]))
                 return false;
+            if (is_large(pstructs[pdpt_entry_addr]))
+                return true;
             if (!is_enabled(pstructs[pd_entry_addr]))
                 return false;
+            if (is_large(pstructs[pd_entry_addr]))
+                return true;
             if (!is_enabled(pstructs[pt_entry_addr]))
                 return false;
 
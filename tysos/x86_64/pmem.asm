@@ -0,0 +1,25 @@
+global _ZN11tysos#2Edll14tysos#2Ex86_644Pmem_12zero_page_nt_Rv_P1y:function
+
+_ZN11tysos#2Edll14tysos#2Ex86_644Pmem_12zero_page_nt_Rv_P1y:
+	; static void zero_page_nt(ulong vaddr);
+	; Clear a 4 kiB page with non-temporal stores, which bypass the cache
+
+	xor rax, rax
+	mov rcx, 4096 / 64
+
+.doloop:
+	movnti [rdi], rax
+	movnti [rdi + 8], rax
+	movnti [rdi + 16], rax
+	movnti [rdi + 24], rax
+	movnti [rdi + 32], rax
+	movnti [rdi + 40], rax
+	movnti [rdi + 48], rax
+	movnti [rdi + 56], rax
+	add rdi, 64
+	dec rcx
+	jnz .doloop
+
+	; make the stores globally visible before the page is handed out
+	sfence
+	ret
@@ -30,6 +30,14 @@ namespace tysos.x86_64
 	{
         ulong gs;
 
+        /** <summary>Interrupt vector of the LApic timer, which also runs the scheduler when
+         * another cpu kicks this one</summary> */
+        internal const byte TimerVector = 0x40;
+
+        /** <summary>The id of this cpu's own LApic, read on the cpu itself at startup.  Used
+         * as the destination when other cpus send it an IPI</summary> */
+        internal uint apic_id;
+
         internal unsafe x86_64_cpu(Virtual_Regions.Region cpu_region)
         {
             /* We divide the cpu region into a pointer at offset 0 which
@@ -58,7 +66,7 @@ namespace tysos.x86_64
                 "LAPIC");
             Program.arch.VirtMem.Map(apic_base, 0x1000, LApicAddress, VirtMem.FLAG_writeable);
 
-            uint apic_id = *(uint*)(LApicAddress + LApic.LAPIC_ID_offset) >> 24;
+            apic_id = *(uint*)(LApicAddress + LApic.LAPIC_ID_offset) >> 24;
             cpu_id = (int)apic_id;
             Formatter.Write("x86_64_cpu: cpu id ", Program.arch.DebugOutput);
             Formatter.Write((ulong)cpu_id, "X", Program.arch.DebugOutput);
@@ -71,8 +79,8 @@ namespace tysos.x86_64
             /* Expose the available interrupt lines */
             for(int i = 32; i < 255; i++)
             {
-                // Vectors 0x40 is used for the LAPIC timer, 0x60 for spurious vector
-                if (i == 0x40 || i == 0x60)
+                // TimerVector is used for the LAPIC timer, 0x60 for spurious vector
+                if (i == TimerVector || i == 0x60)
                     continue;
 
                 x86_64_Interrupt interrupt = new x86_64_Interrupt();
@@ -87,6 +95,18 @@ namespace tysos.x86_64
 
         public LApic CurrentLApic { get { return cur_lapic; } set { cur_lapic = value; } }
 
+        internal override void Kick()
+        {
+            /* Send the cpu a timer interrupt from our own LApic, which makes it run its scheduler.
+             * Every cpu sees its own LApic at the same address, so the destination id cannot be
+             * read from there by the sender: it is the one the target stored in apic_id when
+             * it was started, which is only valid once it has an LApic. */
+            x86_64_cpu cur = Program.arch.CurrentCpu as x86_64_cpu;
+            if (cur == null || cur == this || cur.CurrentLApic == null || cur_lapic == null)
+                return;
+            cur.CurrentLApic.SendIPI(apic_id, TimerVector);
+        }
+
         public Dictionary<int, ulong> interrupt_handlers = new Dictionary<int, ulong>(new Program.MyGenericEqualityComparer<int>());
 	}
 }